@@ -0,0 +1,33 @@
+#ifndef RTX_ALIGNEDALLOCATOR_H
+#define RTX_ALIGNEDALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+
+// Allocator returning memory aligned to Alignment bytes, for cache line and SIMD aligned arrays
+template<typename T, size_t Alignment>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template<typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t count) {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* pointer, size_t) {
+        ::operator delete(pointer, std::align_val_t(Alignment));
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+#endif //RTX_ALIGNEDALLOCATOR_H
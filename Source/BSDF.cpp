@@ -0,0 +1,124 @@
+#include "BSDF.h"
+#include <cmath>
+#include <glm/gtc/constants.hpp>
+
+// Below this GGX turns into a mirror too sharp for float
+static constexpr float MinAlpha = 1e-3f;
+
+struct Lobes {
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    float alpha;
+    float alphaSquared;
+};
+
+static glm::vec3 FresnelSchlick(const glm::vec3& f0, float cosTheta)
+{
+    float m = 1.0f - glm::clamp(cosTheta, 0.0f, 1.0f);
+    float m2 = m * m;
+    return f0 + (1.0f - f0) * (m2 * m2 * m);
+}
+
+// Smith masking of one direction, the two directions are treated as uncorrelated
+static float SmithG1(float cosTheta, float alphaSquared)
+{
+    return 2.0f * cosTheta / (cosTheta + std::sqrt(alphaSquared + (1.0f - alphaSquared) * cosTheta * cosTheta));
+}
+
+// The diffuse lobe only gets what the specular one did not reflect in the view direction,
+// so both agree on it whether they come from EvaluateBSDF or SampleBSDF
+static Lobes GetLobes(const Material& material, float nDotV)
+{
+    Lobes lobes{};
+    glm::vec3 f0 = glm::mix(glm::vec3(0.04f), material.albedo, material.metallic);
+    lobes.specular = f0;
+    lobes.diffuse = material.albedo * (1.0f - material.metallic) * (1.0f - FresnelSchlick(f0, nDotV));
+    lobes.alpha = glm::max(material.roughness * material.roughness, MinAlpha);
+    lobes.alphaSquared = lobes.alpha * lobes.alpha;
+    return lobes;
+}
+
+// Tangent and bitangent for a unit normal without branches (Duff et al. 2017)
+static void BuildBasis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent)
+{
+    float sign = std::copysign(1.0f, n.z);
+    float a = -1.0f / (sign + n.z);
+    float b = n.x * n.y * a;
+    tangent = {1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x};
+    bitangent = {b, sign + n.y * n.y * a, -n.y};
+}
+
+glm::vec3 EvaluateBSDF(const Material& material, const glm::vec3& normal, const glm::vec3& view, const glm::vec3& light)
+{
+    float nDotL = glm::dot(normal, light);
+    if (nDotL <= 0.0f)
+        return glm::vec3(0.0f);
+
+    float nDotV = glm::max(glm::dot(normal, view), 1e-4f);
+    Lobes lobes = GetLobes(material, nDotV);
+
+    glm::vec3 halfway = glm::normalize(view + light);
+    float nDotH = glm::max(glm::dot(normal, halfway), 0.0f);
+    float d = nDotH * nDotH * (lobes.alphaSquared - 1.0f) + 1.0f;
+    float distribution = lobes.alphaSquared / (glm::pi<float>() * d * d);
+    float masking = SmithG1(nDotV, lobes.alphaSquared) * SmithG1(nDotL, lobes.alphaSquared);
+    glm::vec3 fresnel = FresnelSchlick(lobes.specular, glm::dot(view, halfway));
+
+    // The cos of the light direction cancels against the one in the microfacet denominator
+    glm::vec3 specular = fresnel * (distribution * masking / (4.0f * nDotV));
+    glm::vec3 diffuse = lobes.diffuse * (nDotL / glm::pi<float>());
+    return specular + diffuse;
+}
+
+bool SampleBSDF(const Material& material, const glm::vec3& normal, const glm::vec3& view, const glm::vec3& u, BSDFSample& sample)
+{
+    float nDotV = glm::max(glm::dot(normal, view), 1e-4f);
+    Lobes lobes = GetLobes(material, nDotV);
+
+    glm::vec3 tangent, bitangent;
+    BuildBasis(normal, tangent, bitangent);
+
+    // Sample the lobe that reflects more, more often
+    glm::vec3 reflectance = FresnelSchlick(lobes.specular, nDotV);
+    float specularWeight = reflectance.r + reflectance.g + reflectance.b;
+    float diffuseWeight = lobes.diffuse.r + lobes.diffuse.g + lobes.diffuse.b;
+    float specularProbability = diffuseWeight > 0.0f ? specularWeight / (specularWeight + diffuseWeight) : 1.0f;
+
+    if (u.z < specularProbability)
+    {
+        // GGX visible normals (Heitz 2018), in the stretched space where the distribution is a hemisphere
+        glm::vec3 localView(glm::dot(view, tangent), glm::dot(view, bitangent), nDotV);
+        glm::vec3 stretched = glm::normalize(glm::vec3(lobes.alpha * localView.x, lobes.alpha * localView.y, localView.z));
+        float lengthSquared = stretched.x * stretched.x + stretched.y * stretched.y;
+        glm::vec3 t1 = lengthSquared > 0.0f ? glm::vec3(-stretched.y, stretched.x, 0.0f) / std::sqrt(lengthSquared) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 t2 = glm::cross(stretched, t1);
+
+        float r = std::sqrt(u.x);
+        float phi = 2.0f * glm::pi<float>() * u.y;
+        float p1 = r * std::cos(phi);
+        float p2 = r * std::sin(phi);
+        float s = 0.5f * (1.0f + stretched.z);
+        p2 = (1.0f - s) * std::sqrt(1.0f - p1 * p1) + s * p2;
+
+        glm::vec3 hemisphere = p1 * t1 + p2 * t2 + std::sqrt(glm::max(0.0f, 1.0f - p1 * p1 - p2 * p2)) * stretched;
+        glm::vec3 localHalfway = glm::normalize(glm::vec3(lobes.alpha * hemisphere.x, lobes.alpha * hemisphere.y, glm::max(0.0f, hemisphere.z)));
+        glm::vec3 halfway = localHalfway.x * tangent + localHalfway.y * bitangent + localHalfway.z * normal;
+
+        sample.direction = glm::reflect(-view, halfway);
+        float nDotL = glm::dot(normal, sample.direction);
+        if (nDotL <= 0.0f)
+            return false;
+
+        // D and the view masking cancel against the pdf of visible normals
+        glm::vec3 fresnel = FresnelSchlick(lobes.specular, glm::dot(view, halfway));
+        sample.weight = fresnel * (SmithG1(nDotL, lobes.alphaSquared) / specularProbability);
+        return true;
+    }
+
+    // Cosine-weighted hemisphere, the cos and 1 / pi cancel against the pdf
+    float r = std::sqrt(u.x);
+    float phi = 2.0f * glm::pi<float>() * u.y;
+    sample.direction = r * std::cos(phi) * tangent + r * std::sin(phi) * bitangent + std::sqrt(glm::max(0.0f, 1.0f - u.x)) * normal;
+    sample.weight = lobes.diffuse / (1.0f - specularProbability);
+    return true;
+}
@@ -0,0 +1,24 @@
+#ifndef RTX_BSDF_H
+#define RTX_BSDF_H
+
+#include "Scene.h"
+
+// Lambertian diffuse plus GGX microfacet specular. Metallic moves the albedo from the diffuse lobe
+// into the specular reflectance at normal incidence, roughness is squared into the GGX alpha.
+// All directions are normalized, in world space and point away from the surface.
+
+struct BSDFSample {
+    glm::vec3 direction;
+    // BSDF * cos / pdf, what the path throughput gets multiplied with
+    glm::vec3 weight;
+};
+
+// BSDF * cos for a fixed pair of directions, used for light sampling
+glm::vec3 EvaluateBSDF(const Material& material, const glm::vec3& normal, const glm::vec3& view, const glm::vec3& light);
+
+// Picks a lobe by its estimated reflectance and importance samples it, cosine-weighted for the diffuse
+// lobe and by the GGX distribution of visible normals for the specular one. u holds three numbers in [0, 1).
+// Returns false if the sampled direction points into the surface and the path should end.
+bool SampleBSDF(const Material& material, const glm::vec3& normal, const glm::vec3& view, const glm::vec3& u, BSDFSample& sample);
+
+#endif //RTX_BSDF_H
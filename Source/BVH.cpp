@@ -0,0 +1,266 @@
+#include "BVH.h"
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+void BVH::Build(const std::vector<Sphere>& spheres, uint32_t maxLeafSize)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    auto count = (uint32_t)spheres.size();
+    m_MaxLeafSize = std::max(maxLeafSize, 1u);
+    m_Statistics = {};
+    m_Statistics.primitiveCount = count;
+
+    m_Indices.resize(count);
+    std::iota(m_Indices.begin(), m_Indices.end(), 0);
+
+    m_PrimitiveBounds.resize(count);
+    m_Centroids.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const Sphere& sphere = spheres[i];
+        m_PrimitiveBounds[i].min = sphere.position - glm::vec3(sphere.radius);
+        m_PrimitiveBounds[i].max = sphere.position + glm::vec3(sphere.radius);
+        m_Centroids[i] = sphere.position;
+    }
+
+    // Node 1 stays unused so every sibling pair starts on a cache line
+    m_Nodes.resize(std::max(count * 2, 2u));
+    m_NodesUsed = 2;
+
+    BVHNode& root = m_Nodes[0];
+    root.leftFirst = 0;
+    root.count = count;
+    if (count > 0)
+    {
+        UpdateBounds(0);
+        Subdivide(0, 1);
+    }
+
+    m_Spheres.Sync(spheres, m_Indices);
+
+    m_PrimitiveBounds.clear();
+    m_PrimitiveBounds.shrink_to_fit();
+    m_Centroids.clear();
+    m_Centroids.shrink_to_fit();
+
+    m_Statistics.nodeCount = count > 0 ? m_NodesUsed - 1 : 0;
+    m_Statistics.averageLeafSize = m_Statistics.leafCount > 0 ? (float)count / (float)m_Statistics.leafCount : 0.0f;
+    m_Statistics.buildTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+}
+
+void BVH::UpdateBounds(uint32_t nodeIndex)
+{
+    BVHNode& node = m_Nodes[nodeIndex];
+    AABB bounds;
+    for (uint32_t i = 0; i < node.count; i++)
+        bounds.Grow(m_PrimitiveBounds[m_Indices[node.leftFirst + i]]);
+
+    node.boundsMin = bounds.min;
+    node.boundsMax = bounds.max;
+}
+
+float BVH::FindBestSplit(const BVHNode& node, int& axis, float& splitPosition) const
+{
+    float bestCost = FLT_MAX;
+
+    for (int a = 0; a < 3; a++)
+    {
+        float centroidMin = FLT_MAX, centroidMax = -FLT_MAX;
+        for (uint32_t i = 0; i < node.count; i++)
+        {
+            float c = m_Centroids[m_Indices[node.leftFirst + i]][a];
+            centroidMin = std::min(centroidMin, c);
+            centroidMax = std::max(centroidMax, c);
+        }
+        if (centroidMin == centroidMax)
+            continue;
+
+        struct Bin { AABB bounds; uint32_t count = 0; } bins[BinCount];
+        float scale = (float)BinCount / (centroidMax - centroidMin);
+        for (uint32_t i = 0; i < node.count; i++)
+        {
+            uint32_t primitive = m_Indices[node.leftFirst + i];
+            auto binIndex = std::min(BinCount - 1, (uint32_t)((m_Centroids[primitive][a] - centroidMin) * scale));
+            bins[binIndex].count++;
+            bins[binIndex].bounds.Grow(m_PrimitiveBounds[primitive]);
+        }
+
+        // Sweep from both sides to get the cost of every plane between two bins
+        float leftArea[BinCount - 1], rightArea[BinCount - 1];
+        uint32_t leftCount[BinCount - 1], rightCount[BinCount - 1];
+        AABB leftBox, rightBox;
+        uint32_t leftSum = 0, rightSum = 0;
+        for (uint32_t i = 0; i < BinCount - 1; i++)
+        {
+            leftSum += bins[i].count;
+            leftCount[i] = leftSum;
+            leftBox.Grow(bins[i].bounds);
+            leftArea[i] = leftBox.Area();
+
+            rightSum += bins[BinCount - 1 - i].count;
+            rightCount[BinCount - 2 - i] = rightSum;
+            rightBox.Grow(bins[BinCount - 1 - i].bounds);
+            rightArea[BinCount - 2 - i] = rightBox.Area();
+        }
+
+        float binWidth = (centroidMax - centroidMin) / (float)BinCount;
+        for (uint32_t i = 0; i < BinCount - 1; i++)
+        {
+            if (leftCount[i] == 0 || rightCount[i] == 0)
+                continue;
+
+            float cost = (float)leftCount[i] * leftArea[i] + (float)rightCount[i] * rightArea[i];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                axis = a;
+                splitPosition = centroidMin + binWidth * (float)(i + 1);
+            }
+        }
+    }
+
+    return bestCost;
+}
+
+void BVH::Subdivide(uint32_t nodeIndex, uint32_t depth)
+{
+    BVHNode& node = m_Nodes[nodeIndex];
+    m_Statistics.maxDepth = std::max(m_Statistics.maxDepth, depth);
+
+    auto makeLeaf = [&]()
+    {
+        m_Statistics.leafCount++;
+        m_Statistics.maxLeafSize = std::max(m_Statistics.maxLeafSize, node.count);
+    };
+
+    // Deeper trees would overflow the traversal stack
+    if (node.count <= 1 || depth >= StackSize - 1)
+        return makeLeaf();
+
+    int axis = -1;
+    float splitPosition = 0.0f;
+    float splitCost = FindBestSplit(node, axis, splitPosition);
+
+    // Costs are relative to one sphere test, which covers SphereSoA::Width spheres at once
+    AABB nodeBounds{node.boundsMin, node.boundsMax};
+    float leafCost = (float)((node.count + SphereSoA::Width - 1) / SphereSoA::Width) * nodeBounds.Area();
+    splitCost += TraversalCost * nodeBounds.Area();
+    if (axis < 0 || (splitCost >= leafCost && node.count <= m_MaxLeafSize))
+        return makeLeaf();
+
+    // Partition primitives in place
+    int i = (int)node.leftFirst;
+    int j = i + (int)node.count - 1;
+    while (i <= j)
+    {
+        if (m_Centroids[m_Indices[i]][axis] < splitPosition)
+            i++;
+        else
+            std::swap(m_Indices[i], m_Indices[j--]);
+    }
+
+    uint32_t leftCount = (uint32_t)i - node.leftFirst;
+    if (leftCount == 0 || leftCount == node.count)
+        return makeLeaf();
+
+    uint32_t leftChild = m_NodesUsed;
+    m_NodesUsed += 2;
+
+    m_Nodes[leftChild].leftFirst = node.leftFirst;
+    m_Nodes[leftChild].count = leftCount;
+    m_Nodes[leftChild + 1].leftFirst = (uint32_t)i;
+    m_Nodes[leftChild + 1].count = node.count - leftCount;
+    node.leftFirst = leftChild;
+    node.count = 0;
+
+    UpdateBounds(leftChild);
+    UpdateBounds(leftChild + 1);
+    Subdivide(leftChild, depth + 1);
+    Subdivide(leftChild + 1, depth + 1);
+}
+
+static float IntersectAABB(const Ray& ray, const glm::vec3& inverseDirection, const BVHNode& node, float closestT)
+{
+    glm::vec3 t0 = (node.boundsMin - ray.origin) * inverseDirection;
+    glm::vec3 t1 = (node.boundsMax - ray.origin) * inverseDirection;
+    glm::vec3 tSmall = glm::min(t0, t1);
+    glm::vec3 tBig = glm::max(t0, t1);
+
+    float tMin = glm::max(glm::max(tSmall.x, tSmall.y), tSmall.z);
+    float tMax = glm::min(glm::min(tBig.x, tBig.y), tBig.z);
+
+    if (tMax >= tMin && tMax > 0.0f && tMin < closestT)
+        return tMin;
+    return FLT_MAX;
+}
+
+bool BVH::Intersect(const Ray& ray, float& closestT, uint32_t& sphereIndex) const
+{
+    if (m_Indices.empty())
+        return false;
+
+    struct StackEntry { uint32_t node; float distance; };
+    StackEntry stack[StackSize];
+    uint32_t stackPointer = 0;
+
+    glm::vec3 inverseDirection = 1.0f / ray.direction;
+    float a = glm::dot(ray.direction, ray.direction);
+    bool hasHit = false;
+
+    if (IntersectAABB(ray, inverseDirection, m_Nodes[0], closestT) == FLT_MAX)
+        return false;
+
+    uint32_t nodeIndex = 0;
+    while (true)
+    {
+        const BVHNode& node = m_Nodes[nodeIndex];
+        if (node.IsLeaf())
+        {
+            uint32_t slot = 0;
+            if (m_Spheres.Intersect(ray, a, node.leftFirst, node.count, closestT, slot))
+            {
+                sphereIndex = m_Spheres.GetSphereIndex(slot);
+                hasHit = true;
+            }
+        }
+        else
+        {
+            uint32_t nearChild = node.leftFirst;
+            uint32_t farChild = node.leftFirst + 1;
+            float nearDistance = IntersectAABB(ray, inverseDirection, m_Nodes[nearChild], closestT);
+            float farDistance = IntersectAABB(ray, inverseDirection, m_Nodes[farChild], closestT);
+            if (nearDistance > farDistance)
+            {
+                std::swap(nearChild, farChild);
+                std::swap(nearDistance, farDistance);
+            }
+
+            if (nearDistance != FLT_MAX)
+            {
+                if (farDistance != FLT_MAX)
+                    stack[stackPointer++] = {farChild, farDistance};
+                nodeIndex = nearChild;
+                continue;
+            }
+        }
+
+        // Pop the next node that may still hold something closer than the current hit
+        bool found = false;
+        while (stackPointer > 0)
+        {
+            StackEntry entry = stack[--stackPointer];
+            if (entry.distance < closestT)
+            {
+                nodeIndex = entry.node;
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            break;
+    }
+
+    return hasHit;
+}
@@ -0,0 +1,88 @@
+#ifndef RTX_BVH_H
+#define RTX_BVH_H
+
+#include "Scene.h"
+#include "SphereSoA.h"
+#include "AlignedAllocator.h"
+#include <cfloat>
+#include <vector>
+
+struct AABB {
+    glm::vec3 min{FLT_MAX};
+    glm::vec3 max{-FLT_MAX};
+
+    void Grow(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void Grow(const AABB& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    float Area() const {
+        glm::vec3 extent = max - min;
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+};
+
+// 32 bytes, siblings are stored next to each other so a pair fills exactly one cache line
+struct alignas(32) BVHNode {
+    glm::vec3 boundsMin;
+    // Index of the left child for inner nodes (right child follows it), first primitive for leaves
+    uint32_t leftFirst;
+    glm::vec3 boundsMax;
+    uint32_t count;
+
+    bool IsLeaf() const { return count > 0; }
+};
+
+class BVH
+{
+public:
+    struct Statistics {
+        float buildTime = 0.0f; // ms
+        uint32_t primitiveCount = 0;
+        uint32_t nodeCount = 0;
+        uint32_t leafCount = 0;
+        uint32_t maxDepth = 0;
+        uint32_t maxLeafSize = 0;
+        float averageLeafSize = 0.0f;
+    };
+public:
+    // Binned SAH build over the sphere bounds, also refreshes the packed sphere mirror
+    void Build(const std::vector<Sphere>& spheres, uint32_t maxLeafSize = SphereSoA::Width);
+
+    // Front-to-back traversal, returns false if nothing was hit before closestT.
+    // On a hit closestT and sphereIndex (into the array passed to Build) are updated.
+    bool Intersect(const Ray& ray, float& closestT, uint32_t& sphereIndex) const;
+
+    const Statistics& GetStatistics() const { return m_Statistics; }
+    const SphereSoA& GetSphereData() const { return m_Spheres; }
+    uint32_t GetPrimitiveCount() const { return (uint32_t)m_Indices.size(); }
+private:
+    void UpdateBounds(uint32_t nodeIndex);
+    void Subdivide(uint32_t nodeIndex, uint32_t depth);
+    float FindBestSplit(const BVHNode& node, int& axis, float& splitPosition) const;
+private:
+    static constexpr uint32_t BinCount = 16;
+    static constexpr float TraversalCost = 1.0f;
+    static constexpr uint32_t StackSize = 64;
+
+    std::vector<BVHNode, AlignedAllocator<BVHNode, 64>> m_Nodes;
+    std::vector<uint32_t> m_Indices;
+    uint32_t m_NodesUsed = 0;
+    uint32_t m_MaxLeafSize = SphereSoA::Width;
+
+    // Sphere data in leaf order, every leaf is one contiguous range
+    SphereSoA m_Spheres;
+
+    // Per primitive bounds and centroids, only valid during Build
+    std::vector<AABB> m_PrimitiveBounds;
+    std::vector<glm::vec3> m_Centroids;
+
+    Statistics m_Statistics;
+};
+
+#endif //RTX_BVH_H
@@ -0,0 +1,509 @@
+// rtx_bench: fixed-seed microbenchmarks of the tracer hot paths, no window or Vulkan needed.
+//   rtx_bench [--quick] [--warmup N] [--repeats N] [--threads N] [--json file|-]
+//   rtx_bench --convergence [--target-rmse X] [--reference-samples N] [--threads N] [--json file|-]
+//     error against samples per pixel for every shading mode and sampler
+#include "Renderer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct BenchmarkOptions {
+    uint32_t warmup = 2;
+    uint32_t repeats = 10;
+    uint32_t threads = 0;
+    // Upper bound of pixels fed through the single threaded per-function loops
+    uint32_t functionSamples = 1 << 16;
+    bool quick = false;
+    std::string jsonPath;
+    // Samples per pixel to reach targetRMSE instead of frame timings
+    bool convergence = false;
+    float targetRMSE = 0.02f;
+    uint32_t referenceSamples = 1024;
+};
+
+struct BenchmarkCase {
+    uint32_t sphereCount;
+    uint32_t width, height;
+};
+
+struct Timing {
+    double median = 0.0;
+    double p95 = 0.0;
+    double min = 0.0;
+    double mean = 0.0;
+};
+
+static Timing Summarize(std::vector<double> samples)
+{
+    Timing timing;
+    if (samples.empty())
+        return timing;
+
+    std::sort(samples.begin(), samples.end());
+    size_t count = samples.size();
+    timing.median = count % 2 ? samples[count / 2] : 0.5 * (samples[count / 2 - 1] + samples[count / 2]);
+    timing.p95 = samples[std::min(count - 1, (size_t)(0.95 * (double)(count - 1) + 0.5))];
+    timing.min = samples.front();
+    for (double sample : samples)
+        timing.mean += sample;
+    timing.mean /= (double)count;
+    return timing;
+}
+
+// Runs func warmup + repeats times and returns the repeat durations in ns
+static std::vector<double> Measure(const BenchmarkOptions& options, const std::function<void()>& func)
+{
+    for (uint32_t i = 0; i < options.warmup; i++)
+        func();
+
+    std::vector<double> samples;
+    for (uint32_t i = 0; i < options.repeats; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        func();
+        samples.push_back(std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count());
+    }
+    return samples;
+}
+
+// Ground sphere plus randomly placed spheres in front of the default camera
+static Scene GenerateScene(uint32_t sphereCount, uint64_t seed)
+{
+    SauronLT::PCG32 rng(seed);
+    Scene scene;
+
+    for (int i = 0; i < 4; i++)
+    {
+        Material material{};
+        material.albedo = rng.Vec3();
+        material.roughness = rng.Float();
+        material.metallic = rng.Float();
+        scene.materials.push_back(material);
+    }
+
+    scene.spheres.push_back({0, glm::vec3(0.0f, -1001.0f, 0.0f), 1000.0f});
+
+    // Keep the density roughly constant so bigger scenes are not just more overlapping spheres
+    float extent = 2.0f * std::cbrt((float)sphereCount);
+    for (uint32_t i = 1; i < sphereCount; i++)
+    {
+        Sphere sphere;
+        sphere.materialIndex = (int)(rng.UInt() % scene.materials.size());
+        glm::vec3 position = rng.Vec3(-1.0f, 1.0f);
+        sphere.position = glm::vec3(position.x * extent, (position.y + 1.0f) * 0.5f * extent - 1.0f, -(position.z + 1.0f) * extent);
+        sphere.radius = 0.1f + 0.3f * rng.Float();
+        scene.spheres.push_back(sphere);
+    }
+
+    return scene;
+}
+
+static std::string JsonArray(const std::vector<double>& values)
+{
+    std::ostringstream out;
+    out << "[";
+    for (size_t i = 0; i < values.size(); i++)
+        out << (i ? ", " : "") << values[i];
+    out << "]";
+    return out.str();
+}
+
+static std::string JsonTiming(const Timing& timing, const char* unit)
+{
+    std::ostringstream out;
+    out << "{\"median_" << unit << "\": " << timing.median << ", \"p95_" << unit << "\": " << timing.p95
+        << ", \"min_" << unit << "\": " << timing.min << ", \"mean_" << unit << "\": " << timing.mean << "}";
+    return out.str();
+}
+
+// With the JSON on stdout the human readable table goes to stderr, so the output stays parseable
+static FILE* TableStream(const BenchmarkOptions& options)
+{
+    return options.jsonPath == "-" ? stderr : stdout;
+}
+
+// Both engines render the same frames from the same state, the accumulated samples have to be bit identical
+static bool WavefrontMatches(const BenchmarkOptions& options, const BenchmarkCase& benchmarkCase)
+{
+    Renderer megakernel, wavefront;
+    for (Renderer* renderer : {&megakernel, &wavefront})
+    {
+        renderer->GetSettings().threadCount = options.threads;
+        renderer->GetSettings().adaptive = false;
+        renderer->GetSettings().progressivePreview = false;
+        renderer->GetScene() = GenerateScene(benchmarkCase.sphereCount, 0x5eed + benchmarkCase.sphereCount);
+        renderer->InvalidateScene();
+        renderer->Resize(benchmarkCase.width, benchmarkCase.height);
+    }
+    wavefront.GetSettings().wavefront = true;
+
+    for (uint32_t frame = 0; frame < 2; frame++)
+    {
+        megakernel.Render();
+        wavefront.Render();
+    }
+    size_t size = (size_t)benchmarkCase.width * benchmarkCase.height * sizeof(glm::vec4);
+    return memcmp(megakernel.GetAccumulationData(), wavefront.GetAccumulationData(), size) == 0;
+}
+
+static std::string RunCase(const BenchmarkOptions& options, const BenchmarkCase& benchmarkCase, bool& wavefrontMatches)
+{
+    Renderer renderer;
+    renderer.GetSettings().threadCount = options.threads;
+    // Converged tiles would make later frames cheaper than earlier ones
+    renderer.GetSettings().adaptive = false;
+    renderer.GetSettings().progressivePreview = false;
+    renderer.GetScene() = GenerateScene(benchmarkCase.sphereCount, 0x5eed + benchmarkCase.sphereCount);
+    renderer.InvalidateScene();
+    renderer.Resize(benchmarkCase.width, benchmarkCase.height);
+
+    // Full frames, multithreaded
+    uint64_t rayCount = 0;
+    double pathLength = 0.0;
+    uint32_t frames = 0;
+    std::vector<double> renderSamples = Measure(options, [&]()
+    {
+        renderer.Render();
+        rayCount += renderer.GetStatistics().rayCount;
+        pathLength += renderer.GetStatistics().averagePathLength;
+        frames++;
+    });
+    Timing render = Summarize(renderSamples);
+    double raysPerFrame = (double)rayCount / (double)std::max(frames, 1u);
+    pathLength /= (double)std::max(frames, 1u);
+    double pixels = (double)benchmarkCase.width * benchmarkCase.height;
+
+    // The same frames through the wavefront engine, with the secondary rays in the order they were spawned and sorted.
+    // Traversal and sort times are averaged over the frames, summed over the threads.
+    auto measureWavefront = [&](bool sortRays, std::vector<double>& traversal, double& sort)
+    {
+        renderer.GetSettings().wavefront = true;
+        renderer.GetSettings().sortRays = sortRays;
+        renderer.ResetFrameIndex();
+        traversal.assign(WavefrontBatch::TimedBounces, 0.0);
+        sort = 0.0;
+        uint32_t wavefrontFrames = 0;
+        Timing timing = Summarize(Measure(options, [&]()
+        {
+            renderer.Render();
+            const Renderer::Statistics& statistics = renderer.GetStatistics();
+            for (uint32_t bounce = 0; bounce < WavefrontBatch::TimedBounces; bounce++)
+                traversal[bounce] += statistics.traversalTime[bounce];
+            sort += statistics.sortTime;
+            wavefrontFrames++;
+        }));
+        for (double& time : traversal)
+            time /= (double)std::max(wavefrontFrames, 1u);
+        sort /= (double)std::max(wavefrontFrames, 1u);
+        renderer.GetSettings().wavefront = false;
+        return timing;
+    };
+    std::vector<double> traversal, sortedTraversal;
+    double unsortedSort = 0.0, sortTime = 0.0;
+    Timing wavefront = measureWavefront(false, traversal, unsortedSort);
+    Timing sortedWavefront = measureWavefront(true, sortedTraversal, sortTime);
+    wavefrontMatches = WavefrontMatches(options, benchmarkCase);
+    // Sorting only touches the rays after the first bounce
+    double secondaryTraversal = 0.0, sortedSecondaryTraversal = 0.0;
+    for (uint32_t bounce = 1; bounce < WavefrontBatch::TimedBounces; bounce++)
+    {
+        secondaryTraversal += traversal[bounce];
+        sortedSecondaryTraversal += sortedTraversal[bounce];
+    }
+
+    // Single threaded hot paths over an evenly spaced subset of the pixels
+    uint32_t pixelCount = benchmarkCase.width * benchmarkCase.height;
+    uint32_t stride = std::max(1u, pixelCount / options.functionSamples);
+    std::vector<uint32_t> samplePixels;
+    for (uint32_t i = 0; i < pixelCount; i += stride)
+        samplePixels.push_back(i);
+    double calls = (double)samplePixels.size();
+
+    Camera& camera = renderer.GetCamera();
+    volatile float sink = 0.0f;
+
+    // The eager path computes the whole frame up front, the lazy one a direction per call
+    camera.SetRayMode(Camera::RayMode::Cached);
+    Timing rayDirections = Summarize(Measure(options, [&]() { camera.RecalculateRayDirections(); }));
+    camera.SetRayMode(Camera::RayMode::Lazy);
+
+    Timing lazyRayDirection = Summarize(Measure(options, [&]()
+    {
+        glm::vec3 sum(0.0f);
+        for (uint32_t pixel : samplePixels)
+            sum += camera.GetRayDirection(pixel % benchmarkCase.width, pixel / benchmarkCase.width, glm::vec2(0.5f));
+        sink = sink + sum.x;
+    }));
+
+    Timing traceRay = Summarize(Measure(options, [&]()
+    {
+        float distance = 0.0f;
+        for (uint32_t pixel : samplePixels)
+            distance += renderer.TraceRay({camera.GetPosition(), camera.GetRayDirection(pixel % benchmarkCase.width, pixel / benchmarkCase.width)}).distance;
+        sink = sink + distance;
+    }));
+
+    Timing perPixel = Summarize(Measure(options, [&]()
+    {
+        float sum = 0.0f;
+        for (uint32_t pixel : samplePixels)
+            sum += renderer.PerPixel(pixel % benchmarkCase.width, pixel / benchmarkCase.width).r;
+        sink = sink + sum;
+    }));
+
+    const glm::vec4* accumulation = renderer.GetAccumulationData();
+    Timing convert = Summarize(Measure(options, [&]()
+    {
+        uint32_t packed = 0;
+        for (uint32_t pixel : samplePixels)
+            packed ^= Renderer::ConvertToRGBA(glm::clamp(accumulation[pixel] * 0.1f, glm::vec4(0.0f), glm::vec4(1.0f)));
+        sink = sink + (float)(packed & 1);
+    }));
+
+    const BVH::Statistics& bvh = renderer.GetBVHStatistics();
+
+    fprintf(TableStream(options), "%8u spheres %5ux%-5u | frame %9.3fms (p95 %9.3fms) %7.2fns/ray %8.2fMrays/s %8.2fMpix/s %4.2f rays/path | "
+            "wavefront %9.3fms sorted %9.3fms (%s), bounce 1+ traversal %8.3fms sorted %8.3fms + %6.3fms sort | "
+            "TraceRay %7.1fns PerPixel %8.1fns ConvertToRGBA %5.2fns RayDirections %8.3fms (lazy %5.2fns/ray)\n",
+            benchmarkCase.sphereCount, benchmarkCase.width, benchmarkCase.height,
+            render.median * 1e-6, render.p95 * 1e-6, render.median / raysPerFrame, raysPerFrame / render.median * 1e3,
+            pixels / render.median * 1e3, pathLength, wavefront.median * 1e-6, sortedWavefront.median * 1e-6,
+            wavefrontMatches ? "matches" : "MISMATCH", secondaryTraversal, sortedSecondaryTraversal, sortTime, traceRay.median / calls, perPixel.median / calls, convert.median / calls,
+            rayDirections.median * 1e-6, lazyRayDirection.median / calls);
+
+    auto perCall = [calls](Timing timing)
+    {
+        timing.median /= calls;
+        timing.p95 /= calls;
+        timing.min /= calls;
+        timing.mean /= calls;
+        return timing;
+    };
+
+    std::ostringstream json;
+    json << "    {\"spheres\": " << benchmarkCase.sphereCount << ", \"width\": " << benchmarkCase.width << ", \"height\": " << benchmarkCase.height
+         << ",\n     \"bvh\": {\"build_ms\": " << bvh.buildTime << ", \"nodes\": " << bvh.nodeCount << ", \"leaves\": " << bvh.leafCount
+         << ", \"depth\": " << bvh.maxDepth << "}"
+         << ",\n     \"render\": {\"frame\": " << JsonTiming(render, "ns") << ", \"rays_per_frame\": " << raysPerFrame
+         << ", \"ns_per_ray\": " << render.median / raysPerFrame << ", \"mrays_per_s\": " << raysPerFrame / render.median * 1e3
+         << ", \"pixels_per_s\": " << pixels / render.median * 1e9 << ", \"path_length\": " << pathLength << "}"
+         << ",\n     \"wavefront\": {\"frame\": " << JsonTiming(wavefront, "ns") << ", \"traversal_ms\": " << JsonArray(traversal)
+         << ",\n      \"sorted\": {\"frame\": " << JsonTiming(sortedWavefront, "ns") << ", \"traversal_ms\": " << JsonArray(sortedTraversal)
+         << ", \"sort_ms\": " << sortTime << "}, \"matches\": " << (wavefrontMatches ? "true" : "false") << "}"
+         << ",\n     \"functions\": {\"TraceRay\": " << JsonTiming(perCall(traceRay), "ns")
+         << ", \"PerPixel\": " << JsonTiming(perCall(perPixel), "ns")
+         << ", \"ConvertToRGBA\": " << JsonTiming(perCall(convert), "ns")
+         << ", \"RecalculateRayDirections\": " << JsonTiming(rayDirections, "ns")
+         << ", \"GetRayDirection\": " << JsonTiming(perCall(lazyRayDirection), "ns") << "}}";
+    return json.str();
+}
+
+struct ConvergenceCase {
+    const char* name;
+    bool legacyShading;
+    bool importanceSampling;
+    Sampler::Type sampler;
+};
+
+static void SetupConvergence(Renderer& renderer, const BenchmarkOptions& options, const ConvergenceCase& convergenceCase, uint32_t seed)
+{
+    Renderer::Settings& settings = renderer.GetSettings();
+    settings.threadCount = options.threads;
+    settings.adaptive = false;
+    settings.progressivePreview = false;
+    settings.legacyShading = convergenceCase.legacyShading;
+    settings.importanceSampling = convergenceCase.importanceSampling;
+    settings.sampler = convergenceCase.sampler;
+    settings.seed = seed;
+    renderer.GetScene() = GenerateScene(64, 0x5eed + 64);
+    renderer.InvalidateScene();
+    renderer.Resize(320, 180);
+}
+
+static void ResolveClamped(const Renderer& renderer, std::vector<glm::vec3>& out)
+{
+    const glm::vec4* accumulation = renderer.GetAccumulationData();
+    out.resize((size_t)renderer.GetWidth() * renderer.GetHeight());
+    for (size_t i = 0; i < out.size(); i++)
+        out[i] = glm::clamp(glm::vec3(accumulation[i]) / accumulation[i].a, glm::vec3(0.0f), glm::vec3(1.0f));
+}
+
+// High sample count render with independent samples and its own seed, so no sampler is compared against its own pattern
+static std::vector<glm::vec3> RenderReference(const BenchmarkOptions& options, ConvergenceCase convergenceCase)
+{
+    convergenceCase.sampler = Sampler::Type::Independent;
+    Renderer renderer;
+    SetupConvergence(renderer, options, convergenceCase, 1);
+    for (uint32_t i = 0; i < options.referenceSamples; i++)
+        renderer.Render();
+
+    std::vector<glm::vec3> reference;
+    ResolveClamped(renderer, reference);
+    return reference;
+}
+
+// RMSE against the reference at every power of two samples per pixel and the samples it takes to reach targetRMSE
+static std::string RunConvergence(const BenchmarkOptions& options, const ConvergenceCase& convergenceCase, const std::vector<glm::vec3>& reference)
+{
+    Renderer renderer;
+    SetupConvergence(renderer, options, convergenceCase, 0);
+
+    uint32_t maxSamples = std::max(options.referenceSamples / 4, 1u);
+    uint32_t samplesToTarget = 0;
+    double renderTime = 0.0;
+    std::vector<std::pair<uint32_t, float>> curve;
+    std::vector<glm::vec3> image;
+    for (uint32_t samples = 1; samples <= maxSamples; samples++)
+    {
+        renderer.Render();
+        renderTime += renderer.GetStatistics().renderTime;
+
+        bool powerOfTwo = (samples & (samples - 1)) == 0;
+        if (samplesToTarget && !powerOfTwo)
+            continue;
+
+        ResolveClamped(renderer, image);
+        double error = 0.0;
+        for (size_t i = 0; i < image.size(); i++)
+        {
+            glm::vec3 difference = image[i] - reference[i];
+            error += glm::dot(difference, difference);
+        }
+        auto rmse = (float)std::sqrt(error / (3.0 * (double)image.size()));
+
+        if (!samplesToTarget && rmse <= options.targetRMSE)
+            samplesToTarget = samples;
+        if (powerOfTwo)
+            curve.emplace_back(samples, rmse);
+    }
+
+    FILE* table = TableStream(options);
+    fprintf(table, "%-8s %-11s | %s%5u spp to RMSE %.4f (%6.3fms/spp) | RMSE", convergenceCase.name, Sampler::GetName(convergenceCase.sampler),
+            samplesToTarget ? " " : ">", samplesToTarget ? samplesToTarget : maxSamples, options.targetRMSE, renderTime / maxSamples);
+    for (const auto& point : curve)
+        fprintf(table, " %u:%.4f", point.first, point.second);
+    fprintf(table, "\n");
+
+    std::ostringstream json;
+    json << "    {\"shading\": \"" << convergenceCase.name << "\", \"sampler\": \"" << Sampler::GetName(convergenceCase.sampler)
+         << "\", \"target_rmse\": " << options.targetRMSE << ", \"samples_to_target\": " << (samplesToTarget ? std::to_string(samplesToTarget) : "null")
+         << ", \"ms_per_sample\": " << renderTime / maxSamples << ",\n     \"rmse\": [";
+    for (size_t i = 0; i < curve.size(); i++)
+        json << (i ? ", " : "") << "[" << curve[i].first << ", " << curve[i].second << "]";
+    json << "]}";
+    return json.str();
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--quick")
+            options.quick = true;
+        else if (arg == "--warmup" && hasValue)
+            options.warmup = (uint32_t)std::stoul(argv[++i]);
+        else if (arg == "--repeats" && hasValue)
+            options.repeats = std::max((uint32_t)std::stoul(argv[++i]), 1u);
+        else if (arg == "--threads" && hasValue)
+            options.threads = (uint32_t)std::stoul(argv[++i]);
+        else if (arg == "--json" && hasValue)
+            options.jsonPath = argv[++i];
+        else if (arg == "--convergence")
+            options.convergence = true;
+        else if (arg == "--target-rmse" && hasValue)
+            options.targetRMSE = std::stof(argv[++i]);
+        else if (arg == "--reference-samples" && hasValue)
+            options.referenceSamples = std::max((uint32_t)std::stoul(argv[++i]), 1u);
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--quick] [--warmup N] [--repeats N] [--threads N] [--json file|-]\n"
+                      << "       " << argv[0] << " --convergence [--target-rmse X] [--reference-samples N] [--threads N] [--json file|-]\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<uint32_t> sphereCounts = {16, 1024, 65536};
+    std::vector<glm::uvec2> resolutions = {{320, 180}, {1280, 720}, {1920, 1080}};
+    if (options.quick)
+    {
+        sphereCounts = {16, 4096};
+        resolutions = {{320, 180}};
+    }
+
+    std::vector<std::string> results;
+    bool allMatch = true;
+    if (options.convergence)
+    {
+        // Legacy converges to a different, biased image, uniform sampling is the baseline for the same BSDF
+        std::vector<ConvergenceCase> cases = {
+                {"legacy", true, false, Sampler::Type::Independent},
+                {"uniform", false, false, Sampler::Type::Independent},
+        };
+        for (Sampler::Type sampler : {Sampler::Type::Independent, Sampler::Type::Stratified, Sampler::Type::Sobol, Sampler::Type::BlueNoise})
+            cases.push_back({"bsdf", false, true, sampler});
+
+        std::vector<glm::vec3> reference;
+        for (size_t i = 0; i < cases.size(); i++)
+        {
+            // Cases that only differ in the sampler converge to the same image
+            if (i == 0 || cases[i].legacyShading != cases[i - 1].legacyShading || cases[i].importanceSampling != cases[i - 1].importanceSampling)
+                reference = RenderReference(options, cases[i]);
+            results.push_back(RunConvergence(options, cases[i], reference));
+        }
+    }
+    else
+    {
+        for (uint32_t sphereCount : sphereCounts)
+        {
+            for (const glm::uvec2& resolution : resolutions)
+            {
+                bool matches = true;
+                results.push_back(RunCase(options, {sphereCount, resolution.x, resolution.y}, matches));
+                allMatch = allMatch && matches;
+            }
+        }
+    }
+
+    // The JSON is still written, so the failing cases can be looked at
+    int exitCode = 0;
+    if (!allMatch)
+    {
+        std::cerr << "[ERROR] The wavefront engine does not match the megakernel." << std::endl;
+        exitCode = EXIT_FAILURE;
+    }
+
+    if (options.jsonPath.empty())
+        return exitCode;
+
+    std::ostringstream json;
+    json << "{\n  \"simd_width\": " << SphereSoA::Width << ", \"threads\": " << options.threads
+         << ", \"warmup\": " << options.warmup << ", \"repeats\": " << options.repeats << ",\n  \"" << (options.convergence ? "convergence" : "cases") << "\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+        json << results[i] << (i + 1 < results.size() ? ",\n" : "\n");
+    json << "  ]\n}\n";
+
+    if (options.jsonPath == "-")
+    {
+        std::cout << json.str();
+        return exitCode;
+    }
+
+    std::ofstream file(options.jsonPath);
+    if (!file)
+    {
+        std::cerr << "[ERROR] Failed to open " << options.jsonPath << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+    file << json.str();
+    return exitCode;
+}
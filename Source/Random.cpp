@@ -1,6 +1,6 @@
 #include "Random.h"
 
 namespace SauronLT {
-    std::mt19937 Random::s_RandomEngine;
-    std::uniform_int_distribution<std::mt19937::result_type> Random::s_Distribution;
+    std::atomic<uint64_t> Random::s_Seed{0x853c49e6748fea9bULL};
+    std::atomic<uint64_t> Random::s_NextStream{0};
 }
\ No newline at end of file
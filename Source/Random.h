@@ -1,43 +1,149 @@
 #ifndef RTX_RANDOM_H
 #define RTX_RANDOM_H
 
+#include <atomic>
+#include <cmath>
 #include <random>
 #include <glm/glm.hpp>
 
 namespace SauronLT {
+    // PCG-XSH-RR 32 bit generator, 16 bytes of state so every thread (or pixel) can own one
+    class PCG32 {
+    public:
+        PCG32() = default;
+
+        explicit PCG32(uint64_t seed, uint64_t stream = 0) {
+            Seed(seed, stream);
+        }
+
+        void Seed(uint64_t seed, uint64_t stream = 0) {
+            m_State = 0;
+            m_Increment = (stream << 1u) | 1u;
+            UInt();
+            m_State += seed;
+            UInt();
+        }
+
+        uint32_t UInt() {
+            uint64_t oldState = m_State;
+            m_State = oldState * 6364136223846793005ULL + m_Increment;
+            auto xorShifted = (uint32_t)(((oldState >> 18u) ^ oldState) >> 27u);
+            auto rotation = (uint32_t)(oldState >> 59u);
+            return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31));
+        }
+
+        // [0, 1)
+        float Float() {
+            return (float)(UInt() >> 8) * 0x1p-24f;
+        }
+
+        glm::vec3 Vec3() {
+            float x = Float();
+            float y = Float();
+            float z = Float();
+            return {x, y, z};
+        }
+
+        glm::vec3 Vec3(float min, float max) {
+            return Vec3() * (max - min) + min;
+        }
+
+        // Uniformly distributed unit vector, normalizing a point in the cube would favour its corners
+        glm::vec3 InUnitSphere() {
+            float z = 1.0f - 2.0f * Float();
+            float phi = 6.283185307f * Float();
+            float r = std::sqrt(glm::max(0.0f, 1.0f - z * z));
+            return {r * std::cos(phi), r * std::sin(phi), z};
+        }
+
+        void Floats(float* out, uint32_t count) {
+            for (uint32_t i = 0; i < count; i++)
+                out[i] = Float();
+        }
+
+        void Vec3s(glm::vec3* out, uint32_t count, float min = 0.0f, float max = 1.0f) {
+            for (uint32_t i = 0; i < count; i++)
+                out[i] = Vec3(min, max);
+        }
+
+        void InUnitSpheres(glm::vec3* out, uint32_t count) {
+            for (uint32_t i = 0; i < count; i++)
+                out[i] = InUnitSphere();
+        }
+
+    private:
+        uint64_t m_State = 0x853c49e6748fea9bULL;
+        uint64_t m_Increment = 0xda3e39cb94b95bdbULL;
+    };
+
     class Random {
     public:
+        // Threads that draw their first number afterwards start from the new seed, the calling thread is reseeded
         static void Init() {
-            s_RandomEngine.seed(std::random_device()());
+            uint64_t seed = ((uint64_t)std::random_device()() << 32) | std::random_device()();
+            s_Seed.store(seed, std::memory_order_relaxed);
+            Generator().Seed(seed, ThreadStream());
+        }
+
+        // Seeds the generator of the calling thread only, it stays on its own stream
+        static void Seed(uint64_t seed) {
+            Generator().Seed(seed, ThreadStream());
+        }
+
+        static uint32_t Hash(uint32_t x) {
+            x ^= x >> 16;
+            x *= 0x7feb352dU;
+            x ^= x >> 15;
+            x *= 0x846ca68bU;
+            x ^= x >> 16;
+            return x;
+        }
+
+        // Independent generator for one (pixel, frame, bounce) triple, so the
+        // result never depends on thread count or tile scheduling
+        static PCG32 Stream(uint32_t pixel, uint32_t frame, uint32_t bounce) {
+            return PCG32(((uint64_t)Hash(frame) << 32) | Hash(pixel ^ Hash(frame)), bounce);
         }
 
         static uint32_t UInt() {
-            return s_Distribution(s_RandomEngine);
+            return Generator().UInt();
         }
 
         static uint32_t UInt(uint32_t min, uint32_t max) {
-            return min + (s_Distribution(s_RandomEngine) % (max - min + 1));
+            return min + (Generator().UInt() % (max - min + 1));
         }
 
         static float Float() {
-            return (float) s_Distribution(s_RandomEngine) / (float) std::numeric_limits<uint32_t>::max();
+            return Generator().Float();
         }
 
         static glm::vec3 Vec3() {
-            return glm::vec3(Float(), Float(), Float());
+            return Generator().Vec3();
         }
 
         static glm::vec3 Vec3(float min, float max) {
-            return glm::vec3(Float() * (max - min) + min, Float() * (max - min) + min, Float() * (max - min) + min);
+            return Generator().Vec3(min, max);
         }
 
         static glm::vec3 InUnitSphere() {
-            return glm::normalize(Vec3(-1.0f, 1.0f));
+            return Generator().InUnitSphere();
         }
 
     private:
-        static std::mt19937 s_RandomEngine;
-        static std::uniform_int_distribution<std::mt19937::result_type> s_Distribution;
+        // Every thread gets a stream of its own on its first draw, so no two threads (pool workers included)
+        // ever produce the same sequence
+        static uint64_t ThreadStream() {
+            thread_local uint64_t stream = s_NextStream.fetch_add(1, std::memory_order_relaxed);
+            return stream;
+        }
+
+        static PCG32& Generator() {
+            thread_local PCG32 generator(s_Seed.load(std::memory_order_relaxed), ThreadStream());
+            return generator;
+        }
+
+        static std::atomic<uint64_t> s_Seed;
+        static std::atomic<uint64_t> s_NextStream;
     };
 }
 
@@ -0,0 +1,207 @@
+#include "RenderThread.h"
+#include <cstring>
+
+RenderThread::RenderThread()
+        : m_Scene(m_Renderer.GetScene()), m_Camera(m_Renderer.GetCamera()), m_Settings(m_Renderer.GetSettings())
+{
+    m_Thread = std::thread(&RenderThread::Run, this);
+}
+
+RenderThread::~RenderThread()
+{
+    Stop();
+}
+
+void RenderThread::Resize(uint32_t width, uint32_t height)
+{
+    // The render thread's Renderer debounces the size itself
+    m_Width = width;
+    m_Height = height;
+}
+
+void RenderThread::Submit(double inputTime)
+{
+    // Only copy the scene when it was edited, settings and camera are small enough to send every time
+    if (m_SceneSnapshotVersion != m_SceneVersion)
+    {
+        m_SceneSnapshot = std::make_shared<const Scene>(m_Scene);
+        m_SceneSnapshotVersion = m_SceneVersion;
+    }
+
+    auto snapshot = std::make_shared<Snapshot>();
+    snapshot->scene = m_SceneSnapshot;
+    snapshot->sceneVersion = m_SceneVersion;
+    snapshot->geometryVersion = m_GeometryVersion;
+    snapshot->resetVersion = m_ResetVersion;
+    snapshot->cameraPosition = m_Camera.GetPosition();
+    snapshot->cameraDirection = m_Camera.GetDirection();
+    snapshot->settings = m_Settings;
+    snapshot->width = m_Width;
+    snapshot->height = m_Height;
+    snapshot->inputTime = inputTime;
+
+    {
+        std::lock_guard<std::mutex> lock(m_SnapshotMutex);
+        m_PendingSnapshot = std::move(snapshot);
+    }
+    m_SnapshotCondition.notify_one();
+}
+
+bool RenderThread::Present()
+{
+    if (!m_Frames.Acquire())
+        return false;
+
+    const Frame& frame = m_Frames.GetReadBuffer();
+    if (frame.width == 0 || frame.height == 0)
+        return false;
+
+    if (m_Image)
+        m_Image->Reserve(frame.width, frame.height);
+    else
+        m_Image = std::make_shared<SauronLT::Image>(frame.width, frame.height, SauronLT::ImageFormat::RGBA);
+
+    // Only the changed regions are copied and uploaded, the image keeps the rest. The first frame at a new size
+    // is rendered completely, so a reallocated image gets all of it.
+    // Frames are tightly packed, the staging memory has the row length of the image.
+    if (!frame.regions.empty())
+    {
+        auto staging = (uint32_t*)m_Image->BeginWrite();
+        uint32_t stride = m_Image->GetWidth();
+        for (const SauronLT::ImageRegion& region : frame.regions)
+        {
+            for (uint32_t y = region.y; y < region.y + region.height; y++)
+                memcpy(staging + region.x + (size_t)y * stride, frame.pixels.data() + region.x + (size_t)y * frame.width, region.width * sizeof(uint32_t));
+        }
+        m_Image->EndWrite(frame.regions);
+    }
+
+    m_PresentedWidth = frame.width;
+    m_PresentedHeight = frame.height;
+    return true;
+}
+
+glm::vec2 RenderThread::GetImageUV() const
+{
+    if (!m_Image)
+        return glm::vec2(1.0f);
+    return {(float)m_PresentedWidth / (float)m_Image->GetWidth(), (float)m_PresentedHeight / (float)m_Image->GetHeight()};
+}
+
+void RenderThread::Destroy()
+{
+    Stop();
+    if (m_Image)
+        m_Image->Release();
+}
+
+void RenderThread::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_SnapshotMutex);
+        m_Stopping = true;
+    }
+    m_SnapshotCondition.notify_one();
+
+    if (m_Thread.joinable())
+        m_Thread.join();
+}
+
+void RenderThread::Run()
+{
+    std::shared_ptr<const Snapshot> current;
+    uint64_t sceneVersion = ~0ull;
+    uint64_t geometryVersion = ~0ull;
+    uint64_t resetVersion = 0;
+    // The write buffer holds a frame the UI thread never saw, its regions still have to reach the image
+    bool dropped = false;
+    // The last frame traced nothing, every tile has converged
+    bool converged = false;
+
+    while (true)
+    {
+        std::shared_ptr<const Snapshot> snapshot;
+        {
+            // Keep tracing the current state, only sleep while there is nothing to draw into yet or nothing left to
+            // trace. A new snapshot wakes it, a change in it restarts the accumulation.
+            std::unique_lock<std::mutex> lock(m_SnapshotMutex);
+            m_SnapshotCondition.wait(lock, [&]()
+            {
+                return m_Stopping || m_PendingSnapshot || (current && current->width > 0 && current->height > 0 && !converged);
+            });
+            if (m_Stopping)
+                return;
+            snapshot = std::move(m_PendingSnapshot);
+        }
+
+        if (snapshot)
+        {
+            bool reset = false;
+            if (snapshot->sceneVersion != sceneVersion)
+            {
+                m_Renderer.GetScene() = *snapshot->scene;
+                sceneVersion = snapshot->sceneVersion;
+                reset = true;
+            }
+            if (snapshot->geometryVersion != geometryVersion)
+            {
+                m_Renderer.InvalidateScene();
+                geometryVersion = snapshot->geometryVersion;
+            }
+
+            // The renderer notices the move itself and reprojects or restarts the accumulation
+            m_Renderer.GetCamera().SetView(snapshot->cameraPosition, snapshot->cameraDirection);
+
+            if (snapshot->resetVersion != resetVersion)
+            {
+                resetVersion = snapshot->resetVersion;
+                reset = true;
+            }
+
+            m_Renderer.GetSettings() = snapshot->settings;
+            if (reset)
+                m_Renderer.ResetFrameIndex();
+            current = std::move(snapshot);
+        }
+
+        if (current->width == 0 || current->height == 0)
+            continue;
+
+        m_Renderer.Resize(current->width, current->height);
+
+        // Into the renderer's own framebuffer, so converged tiles are neither resolved nor copied again
+        uint32_t sampleCount = m_Renderer.GetFrameIndex();
+        m_Renderer.Render();
+        converged = m_Renderer.GetStatistics().activeFraction == 0.0f;
+
+        // The write buffer belongs to this thread until it is published
+        Frame& frame = m_Frames.GetWriteBuffer();
+        uint32_t width = m_Renderer.GetWidth(), height = m_Renderer.GetHeight();
+        if (!dropped)
+            frame.regions.clear();
+        const std::vector<SauronLT::ImageRegion>& dirty = m_Renderer.GetDirtyRegions();
+        frame.regions.insert(frame.regions.end(), dirty.begin(), dirty.end());
+
+        // Regions of dropped frames overlap, past the size of the frame one region is cheaper
+        uint64_t area = 0;
+        for (const SauronLT::ImageRegion& region : frame.regions)
+            area += (uint64_t)region.width * region.height;
+        if (area >= (uint64_t)width * height)
+            frame.regions.assign(1, {0, 0, width, height});
+
+        frame.width = width;
+        frame.height = height;
+        frame.sampleCount = sampleCount;
+        frame.inputTime = current->inputTime;
+        frame.pixels.resize((size_t)width * height);
+        const uint32_t* pixels = m_Renderer.GetImageData();
+        for (const SauronLT::ImageRegion& region : frame.regions)
+        {
+            for (uint32_t y = region.y; y < region.y + region.height; y++)
+                memcpy(frame.pixels.data() + region.x + (size_t)y * width, pixels + region.x + (size_t)y * width, region.width * sizeof(uint32_t));
+        }
+        frame.statistics = m_Renderer.GetStatistics();
+        frame.bvhStatistics = m_Renderer.GetBVHStatistics();
+        dropped = !m_Frames.Publish();
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef RTX_RENDERTHREAD_H
+#define RTX_RENDERTHREAD_H
+
+#include "Renderer.h"
+#include "TripleBuffer.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a Renderer on its own thread so a slow frame never blocks the UI.
+// The UI thread edits its own copy of the scene, camera and settings and hands them over with Submit
+// as a versioned snapshot; finished frames come back through a triple buffer and are uploaded by Present.
+// Everything here is called from the UI thread.
+class RenderThread
+{
+public:
+    struct Frame {
+        std::vector<uint32_t> pixels;
+        uint32_t width = 0, height = 0;
+        // Changed since the last frame the UI thread acquired, only these pixels are up to date
+        std::vector<SauronLT::ImageRegion> regions;
+        // Samples accumulated into this frame
+        uint32_t sampleCount = 0;
+        // Of the Submit this frame was rendered from
+        double inputTime = 0.0;
+        Renderer::Statistics statistics;
+        BVH::Statistics bvhStatistics;
+    };
+public:
+    RenderThread();
+    ~RenderThread();
+
+    RenderThread(const RenderThread&) = delete;
+    RenderThread& operator=(const RenderThread&) = delete;
+
+    Scene& GetScene() { return m_Scene; }
+    Camera& GetCamera() { return m_Camera; }
+    Renderer::Settings& GetSettings() { return m_Settings; }
+
+    // Spheres changed, the render thread rebuilds its BVH
+    void InvalidateScene() { m_SceneVersion++; m_GeometryVersion++; }
+    // Only materials changed, the BVH is kept
+    void InvalidateMaterials() { m_SceneVersion++; }
+    void ResetFrameIndex() { m_ResetVersion++; }
+    void Resize(uint32_t width, uint32_t height);
+
+    // Hands the current scene, camera, settings and size to the render thread, along with when the input they
+    // reflect was polled
+    void Submit(double inputTime = 0.0);
+    // Uploads the newest finished frame, returns false if nothing new was published since the last call
+    bool Present();
+
+    std::shared_ptr<SauronLT::Image> GetImage() const { return m_Image; }
+    // The image can be larger than the frame, the frame is the [0, uv] corner of it
+    glm::vec2 GetImageUV() const;
+    // The frame shown last
+    const Frame& GetFrame() const { return m_Frames.GetReadBuffer(); }
+
+    // Stops the thread and releases the image, call before SauronLT::Shutdown
+    void Destroy();
+private:
+    struct Snapshot {
+        std::shared_ptr<const Scene> scene;
+        uint64_t sceneVersion = 0;
+        uint64_t geometryVersion = 0;
+        uint64_t resetVersion = 0;
+        glm::vec3 cameraPosition{0.0f};
+        glm::vec3 cameraDirection{0.0f};
+        Renderer::Settings settings;
+        uint32_t width = 0, height = 0;
+        double inputTime = 0.0;
+    };
+
+    void Run();
+    void Stop();
+private:
+    // Only touched by the render thread once it runs
+    Renderer m_Renderer;
+
+    // UI thread state
+    Scene m_Scene;
+    Camera m_Camera;
+    Renderer::Settings m_Settings;
+    uint64_t m_SceneVersion = 0;
+    uint64_t m_GeometryVersion = 0;
+    uint64_t m_ResetVersion = 0;
+    uint32_t m_Width = 0, m_Height = 0;
+    // Shared between snapshots until the scene changes again
+    std::shared_ptr<const Scene> m_SceneSnapshot;
+    uint64_t m_SceneSnapshotVersion = ~0ull;
+    std::shared_ptr<SauronLT::Image> m_Image;
+    uint32_t m_PresentedWidth = 0, m_PresentedHeight = 0;
+
+    // Handoff between the two
+    std::mutex m_SnapshotMutex;
+    std::condition_variable m_SnapshotCondition;
+    std::shared_ptr<const Snapshot> m_PendingSnapshot;
+    bool m_Stopping = false;
+    TripleBuffer<Frame> m_Frames;
+
+    std::thread m_Thread;
+};
+
+#endif //RTX_RENDERTHREAD_H
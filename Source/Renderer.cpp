@@ -1,4 +1,14 @@
 #include "Renderer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+// Rays traced by the current thread, summed up per tile in Render
+static thread_local uint64_t s_RayCount = 0;
+// Path segments traced by the current thread, shadow rays are not part of a path
+static thread_local uint64_t s_PathLength = 0;
+// Queues of the wavefront engine, kept so a thread only allocates for its first tile
+static thread_local WavefrontBatch s_WavefrontBatch;
 
 Renderer::Renderer() : m_Camera(45.0f, 0.001f, 1000.0f) {
     m_Scene.spheres.resize(2);
@@ -22,47 +32,332 @@ Renderer::Renderer() : m_Camera(45.0f, 0.001f, 1000.0f) {
 }
 
 void Renderer::Resize(uint32_t width, uint32_t height) {
-    if (m_Image)
+    // No resize necessary
+    if (m_AccumulationData && m_Width == width && m_Height == height)
     {
-        // No resize necessary
-        if (m_Image->GetWidth() == width && m_Image->GetHeight() == height)
-            return;
-
-        m_Image->Resize(width, height);
+        m_PendingWidth = width;
+        m_PendingHeight = height;
+        m_ResizeRequests = 0;
+        return;
     }
-    else
+
+    // While the size keeps changing the last frame is shown stretched and keeps accumulating,
+    // the buffers only follow once the same size has been asked for resizeDebounce more times
+    if (width != m_PendingWidth || height != m_PendingHeight)
     {
-        m_Image = std::make_shared<SauronLT::Image>(width, height, SauronLT::ImageFormat::RGBA);
+        m_PendingWidth = width;
+        m_PendingHeight = height;
+        m_ResizeRequests = 0;
     }
+    if (m_AccumulationData && ++m_ResizeRequests <= m_Settings.resizeDebounce)
+        return;
+
+    m_Width = width;
+    m_Height = height;
+    m_ResizeRequests = 0;
 
-    delete[] m_ImageData;
-    m_ImageData = new uint32_t[width * height];
+    // The next frame reprojects the samples onto the new pixels, like after a camera move. They stay laid out
+    // for the old size until then. Without reprojection they do not line up with the new pixels.
+    bool keepSamples = m_Settings.reprojection && m_Settings.accumulate && m_FirstHitsValid && m_FrameIndex != 1;
+    size_t keptPixels = keepSamples ? (size_t)m_AccumulationWidth * m_AccumulationHeight : 0;
 
-    delete[] m_AccumulationData;
-    m_AccumulationData = new glm::vec4[width * height];
+    // Buffers only grow, with some headroom so dragging a splitter does not reallocate every step
+    uint32_t pixelCount = width * height;
+    if (pixelCount > m_Capacity)
+    {
+        m_Capacity = std::max(pixelCount, m_Capacity + m_Capacity / 2);
+
+        auto* accumulationData = new glm::vec4[m_Capacity];
+        std::copy(m_AccumulationData, m_AccumulationData + keptPixels, accumulationData);
+        delete[] m_AccumulationData;
+        m_AccumulationData = accumulationData;
+        auto* luminanceSquares = new float[m_Capacity];
+        std::copy(m_LuminanceSquares, m_LuminanceSquares + keptPixels, luminanceSquares);
+        delete[] m_LuminanceSquares;
+        m_LuminanceSquares = luminanceSquares;
+        auto* firstHits = new glm::vec4[m_Capacity];
+        std::copy(m_FirstHits, m_FirstHits + keptPixels, firstHits);
+        delete[] m_FirstHits;
+        m_FirstHits = firstHits;
+        delete[] m_HistoryAccumulation;
+        m_HistoryAccumulation = new glm::vec4[m_Capacity];
+        delete[] m_HistoryLuminanceSquares;
+        m_HistoryLuminanceSquares = new float[m_Capacity];
+        delete[] m_HistoryFirstHits;
+        m_HistoryFirstHits = new glm::vec4[m_Capacity];
+        delete[] m_ImageData;
+        m_ImageData = new uint32_t[m_Capacity];
+    }
 
     m_Camera.Resize(width, height);
+
+    if (!keepSamples)
+        ResetFrameIndex();
+}
+
+glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y, uint32_t sampleIndex)
+{
+    Sampler sampler(m_Settings.sampler, x, y, x + y * m_Width, sampleIndex, m_SequenceSeed);
+
+    glm::vec2 jitter(0.0f);
+    if (m_Settings.jitter)
+        jitter = sampler.Get2D();
+    Ray ray{m_Camera.GetPosition(), m_Camera.GetRayDirection(x, y, jitter)};
+
+    glm::vec3 color = m_Settings.legacyShading ? TracePathLegacy(ray, sampler) : TracePath(ray, sampler);
+    return {color, 1.0f};
+}
+
+// Lighting of the BSDF path
+static const glm::vec3 s_SkyColor(0.1f, 0.4f, 0.8f);
+static const glm::vec3 s_SunDirection = glm::normalize(glm::vec3(1.0f));
+// Irradiance of pi makes a white diffuse surface facing the sun as bright as the legacy shading
+static const glm::vec3 s_SunColor(glm::pi<float>());
+
+// Where a ray found by BVH::Intersect hit its sphere
+static HitPayload GetHitPayload(const Ray& ray, const Sphere& sphere, float distance)
+{
+    HitPayload hit{};
+    hit.distance = distance;
+    glm::vec3 origin = ray.origin - sphere.position;
+    hit.position = origin + ray.direction * hit.distance;
+    hit.normal = glm::normalize(hit.position);
+    hit.position += sphere.position;
+    hit.hitSphere = sphere;
+    return hit;
+}
+
+glm::vec3 Renderer::TracePath(Ray ray, Sampler& sampler)
+{
+    glm::vec3 pixelColor(0.0f);
+    glm::vec3 throughput(1.0f);
+
+    for (uint32_t i = 0; i < m_Settings.maxBounces; i++) {
+        s_PathLength++;
+        HitPayload hitPayload = TraceRay(ray);
+
+        if (hitPayload.distance < 0.0f) {
+            pixelColor += s_SkyColor * throughput;
+            break;
+        }
+
+        const Material& material = m_Scene.materials[hitPayload.hitSphere.materialIndex];
+        glm::vec3 view = -ray.direction;
+        glm::vec3 origin = hitPayload.position + hitPayload.normal * 0.0001f;
+
+        // A delta light can never be hit by a sampled direction, so it is sampled explicitly
+        glm::vec3 sun = EvaluateBSDF(material, hitPayload.normal, view, s_SunDirection);
+        if (sun != glm::vec3(0.0f) && TraceRay({origin, s_SunDirection}).distance < 0.0f)
+            pixelColor += sun * s_SunColor * throughput;
+
+        glm::vec3 direction;
+        if (!Scatter(material, hitPayload.normal, view, i, sampler, throughput, direction))
+            break;
+        ray = {origin, direction};
+    }
+
+    return pixelColor;
+}
+
+bool Renderer::Scatter(const Material& material, const glm::vec3& normal, const glm::vec3& view, uint32_t bounce, Sampler& sampler,
+                       glm::vec3& throughput, glm::vec3& direction) const
+{
+    // The camera has the first group of dimensions, every bounce the next one
+    sampler.SetDimension((bounce + 1) * Sampler::DimensionsPerGroup);
+    glm::vec2 u = sampler.Get2D();
+    BSDFSample sample{};
+    if (!m_Settings.importanceSampling)
+    {
+        // Every direction of the hemisphere has pdf 1 / (2 pi), a point on the sphere flipped to the normal's side
+        float z = 1.0f - 2.0f * u.x;
+        float r = std::sqrt(glm::max(0.0f, 1.0f - z * z));
+        float phi = 2.0f * glm::pi<float>() * u.y;
+        sample.direction = {r * std::cos(phi), r * std::sin(phi), z};
+        if (glm::dot(sample.direction, normal) < 0.0f)
+            sample.direction = -sample.direction;
+        sample.weight = EvaluateBSDF(material, normal, view, sample.direction) * (2.0f * glm::pi<float>());
+    }
+    else if (!SampleBSDF(material, normal, view, {u, sampler.Get1D()}, sample))
+        return false;
+
+    throughput *= sample.weight;
+    sampler.SetDimension((bounce + 1) * Sampler::DimensionsPerGroup + 3);
+    if (!ContinuePath(throughput, bounce, sampler))
+        return false;
+    direction = sample.direction;
+    return true;
 }
 
-void Renderer::Destroy() {
-    m_Image->Release();
-    m_Scene.spheres.clear();
+// Spreads the lower 10 bits apart with two zero bits between each, for interleaving three of them into a Morton code
+static uint32_t ExpandBits(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xff0000ffu;
+    v = (v * 0x00000101u) & 0x0f00f00fu;
+    v = (v * 0x00000011u) & 0xc30c30c3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
 }
 
-std::shared_ptr<SauronLT::Image> Renderer::GetImage() {
-    return m_Image;
+// Reorders batch.rays by direction octant, then by a 9 bit per axis Morton code of the origin within the bounds of
+// all origins. The result of every path stays the same, only the order the rays are traced in changes.
+static void SortRays(WavefrontBatch& batch)
+{
+    uint32_t count = batch.rays.GetCount();
+    AABB bounds;
+    for (uint32_t i = 0; i < count; i++)
+        bounds.Grow(batch.rays.GetRay(i).origin);
+    glm::vec3 scale = 511.0f / glm::max(bounds.max - bounds.min, glm::vec3(1e-6f));
+
+    batch.sortKeys.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Ray ray = batch.rays.GetRay(i);
+        glm::uvec3 cell = glm::clamp((ray.origin - bounds.min) * scale, glm::vec3(0.0f), glm::vec3(511.0f));
+        uint32_t octant = (ray.direction.x < 0.0f ? 1u : 0u) | (ray.direction.y < 0.0f ? 2u : 0u) | (ray.direction.z < 0.0f ? 4u : 0u);
+        uint32_t key = octant << 27 | ExpandBits(cell.x) << 2 | ExpandBits(cell.y) << 1 | ExpandBits(cell.z);
+        batch.sortKeys[i] = (uint64_t)key << 32 | i;
+    }
+    std::sort(batch.sortKeys.begin(), batch.sortKeys.end());
+
+    // The next queue is free until shading fills it
+    batch.nextRays.Clear();
+    for (uint64_t sortKey : batch.sortKeys)
+    {
+        auto i = (uint32_t)sortKey;
+        batch.nextRays.Push(batch.rays.GetPath(i), batch.rays.GetRay(i));
+    }
+    std::swap(batch.rays, batch.nextRays);
 }
 
-glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y)
+void Renderer::TraceWavefront(WavefrontBatch& batch)
 {
-    Ray ray{m_Camera.GetPosition(), m_Camera.GetRayDirections()[x + y * m_Image->GetWidth()]};
+    batch.Prepare();
+    std::fill(std::begin(batch.traversalTime), std::end(batch.traversalTime), 0);
+    batch.sortTime = 0;
+    uint32_t pathCount = batch.GetPathCount();
+
+    // Generate: camera rays, with the same sampler dimensions PerPixel uses
+    batch.rays.Clear();
+    for (uint32_t path = 0; path < pathCount; path++)
+    {
+        uint32_t x = batch.x[path], y = batch.y[path];
+        Sampler sampler(m_Settings.sampler, x, y, x + y * m_Width, batch.sampleIndex[path], m_SequenceSeed);
+        glm::vec2 jitter(0.0f);
+        if (m_Settings.jitter)
+            jitter = sampler.Get2D();
+        batch.rays.Push(path, {m_Camera.GetPosition(), m_Camera.GetRayDirection(x, y, jitter)});
+
+        batch.throughputR[path] = 1.0f;
+        batch.throughputG[path] = 1.0f;
+        batch.throughputB[path] = 1.0f;
+        batch.radiance[path] = glm::vec3(0.0f);
+    }
+
+    for (uint32_t bounce = 0; bounce < m_Settings.maxBounces && batch.rays.GetCount() > 0; bounce++)
+    {
+        // Camera rays are coherent already, scattered ones go everywhere
+        if (m_Settings.sortRays && bounce > 0)
+        {
+            auto sortStart = std::chrono::steady_clock::now();
+            SortRays(batch);
+            batch.sortTime += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sortStart).count();
+        }
+        uint64_t& traversalTime = batch.traversalTime[std::min(bounce, WavefrontBatch::TimedBounces - 1)];
 
+        // Intersect: nothing but traversal, so the BVH and the sphere data stay in cache for the whole queue
+        auto traversalStart = std::chrono::steady_clock::now();
+        uint32_t rayCount = batch.rays.GetCount();
+        for (uint32_t i = 0; i < rayCount; i++)
+        {
+            float distance = FLT_MAX;
+            uint32_t sphereIndex = 0;
+            batch.hitDistance[i] = m_BVH.Intersect(batch.rays.GetRay(i), distance, sphereIndex) ? distance : -1.0f;
+            batch.hitSphere[i] = sphereIndex;
+        }
+        s_RayCount += rayCount;
+        s_PathLength += rayCount;
+        traversalTime += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traversalStart).count();
+
+        // Shade: the sky ends a path, a surface queues a shadow ray and the continuation of the path
+        batch.nextRays.Clear();
+        batch.shadowRays.Clear();
+        for (uint32_t i = 0; i < rayCount; i++)
+        {
+            uint32_t path = batch.rays.GetPath(i);
+            glm::vec3 throughput(batch.throughputR[path], batch.throughputG[path], batch.throughputB[path]);
+            if (batch.hitDistance[i] < 0.0f)
+            {
+                batch.radiance[path] += s_SkyColor * throughput;
+                continue;
+            }
+
+            Ray ray = batch.rays.GetRay(i);
+            HitPayload hitPayload = GetHitPayload(ray, m_Scene.spheres[batch.hitSphere[i]], batch.hitDistance[i]);
+            const Material& material = m_Scene.materials[hitPayload.hitSphere.materialIndex];
+            glm::vec3 view = -ray.direction;
+            glm::vec3 origin = hitPayload.position + hitPayload.normal * 0.0001f;
+
+            glm::vec3 sun = EvaluateBSDF(material, hitPayload.normal, view, s_SunDirection);
+            if (sun != glm::vec3(0.0f))
+            {
+                glm::vec3 contribution = sun * s_SunColor * throughput;
+                uint32_t shadow = batch.shadowRays.GetCount();
+                batch.shadowRays.Push(path, {origin, s_SunDirection});
+                batch.shadowR[shadow] = contribution.r;
+                batch.shadowG[shadow] = contribution.g;
+                batch.shadowB[shadow] = contribution.b;
+            }
+
+            uint32_t x = batch.x[path], y = batch.y[path];
+            Sampler sampler(m_Settings.sampler, x, y, x + y * m_Width, batch.sampleIndex[path], m_SequenceSeed);
+            glm::vec3 direction;
+            if (!Scatter(material, hitPayload.normal, view, bounce, sampler, throughput, direction))
+                continue;
+
+            batch.throughputR[path] = throughput.r;
+            batch.throughputG[path] = throughput.g;
+            batch.throughputB[path] = throughput.b;
+            batch.nextRays.Push(path, {origin, direction});
+        }
+
+        // Shadow: the sun only adds to paths that see it
+        traversalStart = std::chrono::steady_clock::now();
+        uint32_t shadowCount = batch.shadowRays.GetCount();
+        for (uint32_t i = 0; i < shadowCount; i++)
+        {
+            float distance = FLT_MAX;
+            uint32_t sphereIndex = 0;
+            if (!m_BVH.Intersect(batch.shadowRays.GetRay(i), distance, sphereIndex))
+                batch.radiance[batch.shadowRays.GetPath(i)] += glm::vec3(batch.shadowR[i], batch.shadowG[i], batch.shadowB[i]);
+        }
+        s_RayCount += shadowCount;
+        traversalTime += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traversalStart).count();
+
+        std::swap(batch.rays, batch.nextRays);
+    }
+}
+
+bool Renderer::ContinuePath(glm::vec3& throughput, uint32_t bounce, Sampler& sampler) const
+{
+    if (!m_Settings.russianRoulette || bounce + 1 < m_Settings.rouletteMinBounces)
+        return true;
+
+    // Paths that carry little are likely to end, the survivors make up for the ones that did
+    float survival = glm::min(glm::max(throughput.r, glm::max(throughput.g, throughput.b)), 0.95f);
+    if (sampler.Get1D() >= survival)
+        return false;
+    throughput /= survival;
+    return true;
+}
+
+glm::vec3 Renderer::TracePathLegacy(Ray ray, Sampler& sampler)
+{
     glm::vec3 skyColor(0.1f, 0.4f, 0.8f);
     glm::vec3 pixelColor(0.0f);
 
-    int bounces = 5;
-    float multiplier = 1.0f;
-    for (int i = 0; i < bounces; i++) {
+    glm::vec3 multiplier(1.0f);
+    for (uint32_t i = 0; i < m_Settings.maxBounces; i++) {
+        s_PathLength++;
         HitPayload hitPayload = TraceRay(ray);
 
         if (hitPayload.distance < 0.0f) {
@@ -79,13 +374,17 @@ glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y)
         multiplier *= 0.7f;
 
         ray.origin = hitPayload.position + hitPayload.normal * 0.0001f;
-        ray.direction = glm::reflect(ray.direction, hitPayload.normal + material.roughness * SauronLT::Random::Vec3(-0.5f, 0.5f));
+        sampler.SetDimension((i + 1) * Sampler::DimensionsPerGroup);
+        glm::vec3 offset(sampler.Get2D(), sampler.Get1D());
+        ray.direction = glm::reflect(ray.direction, hitPayload.normal + material.roughness * (offset - 0.5f));
+        if (!ContinuePath(multiplier, i, sampler))
+            break;
     }
 
-    return {pixelColor, 1.0f};
+    return pixelColor;
 }
 
-static uint32_t ConvertToRGBA(const glm::vec4& color)
+uint32_t Renderer::ConvertToRGBA(const glm::vec4& color)
 {
     auto r = (uint8_t)(color.r * 255.0f);
     auto g = (uint8_t)(color.g * 255.0f);
@@ -96,66 +395,418 @@ static uint32_t ConvertToRGBA(const glm::vec4& color)
     return result;
 }
 
-void Renderer::Render() {
-    m_Camera.Update(0.016f);
+glm::vec4 Renderer::TraceFirstHit(uint32_t x, uint32_t y)
+{
+    s_RayCount++;
+    Ray ray{m_Camera.GetPosition(), m_Camera.GetRayDirection(x, y, glm::vec2(0.5f))};
+    float distance = FLT_MAX;
+    uint32_t sphereIndex = 0;
+    if (!m_BVH.Intersect(ray, distance, sphereIndex))
+        return {ray.direction, -1.0f};
+    return {ray.origin + ray.direction * distance, (float)sphereIndex};
+}
 
-    // TODO
-    if (m_FrameIndex == 1)
-        memset(m_AccumulationData, 0, m_Image->GetWidth() * m_Image->GetHeight() * sizeof(glm::vec4));
+bool Renderer::Reproject(const glm::vec4& firstHit, uint32_t& historyIndex) const
+{
+    // The sky is infinitely far away, only the rotation of the camera moves it
+    bool sky = firstHit.w < 0.0f;
+    glm::vec4 clip = m_PreviousViewProjection * glm::vec4(glm::vec3(firstHit), sky ? 0.0f : 1.0f);
+    if (clip.w <= 0.0f)
+        return false;
+
+    // Row 0 is at the bottom, the same as the camera's rays
+    glm::vec2 pixel = (glm::vec2(clip) / clip.w * 0.5f + 0.5f) * glm::vec2((float)m_HistoryWidth, (float)m_HistoryHeight);
+    if (pixel.x < 0.0f || pixel.y < 0.0f || pixel.x >= (float)m_HistoryWidth || pixel.y >= (float)m_HistoryHeight)
+        return false;
+    historyIndex = (uint32_t)pixel.x + (uint32_t)pixel.y * m_HistoryWidth;
+
+    const glm::vec4& previous = m_HistoryFirstHits[historyIndex];
+    if (previous.w != firstHit.w)
+        return false;
+    if (sky)
+        return true;
+
+    // On the same sphere the previous hit lies close to the tangent plane, unless it is on a part that got hidden
+    const Sphere& sphere = m_Scene.spheres[(uint32_t)firstHit.w];
+    glm::vec3 position(firstHit);
+    glm::vec3 normal = (position - sphere.position) / sphere.radius;
+    float depth = glm::length(position - m_Camera.GetPosition());
+    return std::abs(glm::dot(glm::vec3(previous) - position, normal)) < 0.01f * depth;
+}
+
+void Renderer::RenderPreview(uint32_t* target, uint32_t level)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    std::atomic<uint64_t> rayCount{0};
+    std::atomic<uint64_t> pathLength{0};
 
-    for (uint32_t y = 0; y < m_Image->GetHeight(); y++)
+    uint32_t width = m_Width;
+    uint32_t height = m_Height;
+    uint32_t blockSize = 1u << level;
+    uint32_t blocksX = (width + blockSize - 1) / blockSize;
+    uint32_t blocksY = (height + blockSize - 1) / blockSize;
+
+    // Nothing of the accumulation is touched, so the next full resolution frame continues or reprojects it
+    m_SequenceSeed = SauronLT::Random::Hash(m_Settings.seed) + m_FrameCounter;
+    m_FrameCounter++;
+
+    uint32_t* pixels = target ? target : m_ImageData;
+
+    m_ThreadPool.Resize(m_Settings.threadCount);
+    m_ThreadPool.ParallelFor(blocksY, [&](uint32_t blockY)
     {
-        for (uint32_t x = 0; x < m_Image->GetWidth(); x++)
+        uint64_t rowRayStart = s_RayCount;
+        uint64_t rowPathStart = s_PathLength;
+
+        uint32_t minY = blockY * blockSize;
+        uint32_t maxY = std::min(minY + blockSize, height);
+        for (uint32_t blockX = 0; blockX < blocksX; blockX++)
         {
-            glm::vec4 color = PerPixel(x, y);
-            m_AccumulationData[x + y * m_Image->GetWidth()] += color;
+            // Through the middle of the block
+            uint32_t minX = blockX * blockSize;
+            uint32_t maxX = std::min(minX + blockSize, width);
+            glm::vec4 color = glm::clamp(PerPixel((minX + maxX) / 2, (minY + maxY) / 2), glm::vec4(0.0f), glm::vec4(1.0f));
+            uint32_t packed = ConvertToRGBA(color);
+
+            for (uint32_t y = minY; y < maxY; y++)
+            {
+                for (uint32_t x = minX; x < maxX; x++)
+                    pixels[x + y * width] = packed;
+            }
+        }
+
+        rayCount.fetch_add(s_RayCount - rowRayStart, std::memory_order_relaxed);
+        pathLength.fetch_add(s_PathLength - rowPathStart, std::memory_order_relaxed);
+    });
+
+    uint64_t blockCount = (uint64_t)blocksX * blocksY;
+    m_Statistics.rayCount = rayCount.load();
+    m_Statistics.renderTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+    m_Statistics.activeFraction = width * height > 0 ? (float)((double)blockCount / ((double)width * height)) : 0.0f;
+    m_Statistics.samplesPerPixel = 1;
+    m_Statistics.averagePathLength = blockCount > 0 ? (float)((double)pathLength.load() / (double)blockCount) : 0.0f;
+    m_Statistics.reprojectedFraction = 0.0f;
+    m_Statistics.previewLevel = level;
+    std::fill(std::begin(m_Statistics.traversalTime), std::end(m_Statistics.traversalTime), 0.0f);
+    m_Statistics.sortTime = 0.0f;
+    if (blockCount > 0)
+        m_FullFrameTime = m_Statistics.renderTime * (float)((double)width * height / (double)blockCount);
+
+    m_DirtyRegions.clear();
+    if (!target)
+        m_DirtyRegions.push_back({0, 0, width, height});
+}
+
+static float Luminance(const glm::vec3& color)
+{
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
 
-            color = glm::clamp(color, glm::vec4(0.0f), glm::vec4(1.0f));
-            m_ImageData[x + y * m_Image->GetWidth()] = ConvertToRGBA(color);
+void Renderer::Render(uint32_t* target) {
+    m_Camera.SetRayMode(m_Settings.lazyRays ? Camera::RayMode::Lazy : Camera::RayMode::Cached);
+
+    if (m_SceneDirty || m_BVH.GetPrimitiveCount() != m_Scene.spheres.size())
+    {
+        m_BVH.Build(m_Scene.spheres);
+        m_SceneDirty = false;
+    }
+
+    // Any camera move or restarted accumulation counts as interaction. Refining waits a moment after the last one,
+    // the render thread can finish several frames before the UI sends the next change.
+    glm::mat4 viewProjection = m_Camera.GetProjection() * m_Camera.GetView();
+    bool interacting = m_Restarted || viewProjection != m_LastViewProjection;
+    m_LastViewProjection = viewProjection;
+    m_Restarted = false;
+    auto now = std::chrono::steady_clock::now();
+    if (interacting)
+        m_LastInteraction = now;
+    bool idle = now - m_LastInteraction > std::chrono::milliseconds(100);
+
+    // The coarsest preview is a sixteenth of the pixels
+    constexpr uint32_t maxPreviewLevel = 2;
+    if (!m_Settings.progressivePreview)
+        m_PreviewLevel = 0;
+    else if (interacting)
+    {
+        m_PreviewLevel = 0;
+        while (m_PreviewLevel < maxPreviewLevel && m_FullFrameTime / (float)(1u << (2 * m_PreviewLevel)) > m_Settings.previewFrameBudget)
+            m_PreviewLevel++;
+    }
+    else if (idle && m_PreviewLevel > 0)
+        m_PreviewLevel--;
+
+    if (m_PreviewLevel > 0)
+    {
+        RenderPreview(target, m_PreviewLevel);
+        return;
+    }
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    std::atomic<uint64_t> rayCount{0};
+    std::atomic<uint64_t> pathLength{0};
+    std::atomic<uint64_t> reprojectedPixels{0};
+    // ns
+    std::atomic<uint64_t> traversalTime[WavefrontBatch::TimedBounces] = {};
+    std::atomic<uint64_t> sortTime{0};
+
+    uint32_t width = m_Width;
+    uint32_t height = m_Height;
+
+    // A camera move or a resize either carries the samples over into the new view or starts the accumulation again
+    bool reprojection = m_Settings.reprojection && m_Settings.accumulate;
+    bool reproject = false;
+    bool resized = m_AccumulationWidth != width || m_AccumulationHeight != height;
+    if ((viewProjection != m_PreviousViewProjection || resized) && m_FrameIndex != 1)
+    {
+        reproject = reprojection && m_FirstHitsValid;
+        ResetFrameIndex();
+    }
+    bool firstFrame = m_FrameIndex == 1 && !reproject;
+    // Only traced when the accumulation starts, they stay valid as long as the camera and the scene do
+    bool traceFirstHits = reprojection && m_FrameIndex == 1;
+    if (m_FrameIndex == 1)
+        m_FirstHitsValid = traceFirstHits;
+    m_PreviousViewProjection = viewProjection;
+
+    // The previous frame is read while the new one is written
+    if (reproject)
+    {
+        std::swap(m_AccumulationData, m_HistoryAccumulation);
+        std::swap(m_LuminanceSquares, m_HistoryLuminanceSquares);
+        std::swap(m_FirstHits, m_HistoryFirstHits);
+        m_HistoryWidth = m_AccumulationWidth;
+        m_HistoryHeight = m_AccumulationHeight;
+    }
+    m_AccumulationWidth = width;
+    m_AccumulationHeight = height;
+    float maxHistory = (float)std::max(m_Settings.reprojectionMaxSamples, 1u);
+    // Only the BSDF path has a wavefront version
+    bool wavefront = m_Settings.wavefront && !m_Settings.legacyShading;
+
+    uint32_t tileSize = std::max(m_Settings.tileSize, 1u);
+    uint32_t tilesX = (width + tileSize - 1) / tileSize;
+    uint32_t tilesY = (height + tileSize - 1) / tileSize;
+    uint32_t tileCount = tilesX * tilesY;
+
+    // Every tile starts out active, converged ones stay skipped until the accumulation is reset
+    bool adaptive = m_Settings.adaptive && m_Settings.accumulate;
+    if (firstFrame || reproject || !adaptive || m_ActiveTiles.size() != tileCount)
+        m_ActiveTiles.assign(tileCount, 1);
+    if (firstFrame)
+        m_SampleBudget = 0;
+    if (reproject)
+        m_SampleBudget = std::min(m_SampleBudget, (uint32_t)maxHistory);
+
+    uint32_t activeTiles = 0;
+    uint64_t activePixels = 0;
+    for (uint32_t i = 0; i < tileCount; i++)
+    {
+        if (!m_ActiveTiles[i])
+            continue;
+        activeTiles++;
+        activePixels += (uint64_t)(std::min((i % tilesX + 1) * tileSize, width) - (i % tilesX) * tileSize) *
+                        (std::min((i / tilesX + 1) * tileSize, height) - (i / tilesX) * tileSize);
+    }
+
+    // Converged tiles hand their share of the frame to the remaining ones
+    uint32_t samples = 1;
+    if (adaptive && activeTiles > 0)
+        samples = std::min(tileCount / activeTiles, std::max(m_Settings.adaptiveMaxSamples, 1u));
+    if (activeTiles > 0)
+        m_SampleBudget += samples;
+
+    if (firstFrame || reproject)
+        m_SequenceSeed = SauronLT::Random::Hash(m_Settings.seed) + m_FrameCounter;
+    m_FrameCounter += samples;
+
+    // Skipped tiles keep what they showed before, unless the target is a fresh buffer or the view changed
+    bool showSampleCount = m_Settings.showSampleCount;
+    bool resolveAll = target || reproject || showSampleCount || showSampleCount != m_ShowingSampleCount;
+    m_ShowingSampleCount = showSampleCount;
+
+    uint32_t* pixels = target ? target : m_ImageData;
+
+    // Only the rows of active tiles change, adjacent ones merged into one region
+    m_DirtyRegions.clear();
+    if (!target && (resolveAll || activeTiles == tileCount))
+        m_DirtyRegions.push_back({0, 0, width, height});
+    else if (!target)
+    {
+        for (uint32_t tileY = 0; tileY < tilesY; tileY++)
+        {
+            uint32_t minY = tileY * tileSize;
+            uint32_t maxY = std::min(minY + tileSize, height);
+            for (uint32_t tileX = 0; tileX < tilesX; tileX++)
+            {
+                if (!m_ActiveTiles[tileX + tileY * tilesX])
+                    continue;
+
+                uint32_t first = tileX;
+                while (tileX + 1 < tilesX && m_ActiveTiles[tileX + 1 + tileY * tilesX])
+                    tileX++;
+                uint32_t minX = first * tileSize;
+                uint32_t maxX = std::min((tileX + 1) * tileSize, width);
+                m_DirtyRegions.push_back({minX, minY, maxX - minX, maxY - minY});
+            }
         }
     }
 
-    m_Image->SetData(m_ImageData);
+    float threshold = m_Settings.adaptiveThreshold;
+    auto minSamples = (float)std::max(m_Settings.adaptiveMinSamples, 2u);
+    float inverseSampleBudget = 1.0f / (float)std::max(m_SampleBudget, 1u);
+
+    m_ThreadPool.Resize(m_Settings.threadCount);
+    m_ThreadPool.ParallelFor(tileCount, [&](uint32_t tileIndex)
+    {
+        bool active = m_ActiveTiles[tileIndex];
+        if (!active && !resolveAll)
+            return;
+
+        uint32_t minX = (tileIndex % tilesX) * tileSize;
+        uint32_t minY = (tileIndex / tilesX) * tileSize;
+        uint32_t maxX = std::min(minX + tileSize, width);
+        uint32_t maxY = std::min(minY + tileSize, height);
+        uint64_t tileRayStart = s_RayCount;
+        uint64_t tilePathStart = s_PathLength;
+        uint64_t tileReprojected = 0;
+        bool converged = true;
+
+        if (traceFirstHits)
+        {
+            for (uint32_t y = minY; y < maxY; y++)
+            {
+                for (uint32_t x = minX; x < maxX; x++)
+                {
+                    uint32_t index = x + y * width;
+                    glm::vec4 firstHit = TraceFirstHit(x, y);
+                    m_FirstHits[index] = firstHit;
+                    if (!reproject)
+                        continue;
+
+                    // Whatever is not found in the previous view starts from nothing
+                    glm::vec4 accumulated(0.0f);
+                    float luminanceSquares = 0.0f;
+                    uint32_t historyIndex = 0;
+                    if (Reproject(firstHit, historyIndex))
+                    {
+                        accumulated = m_HistoryAccumulation[historyIndex];
+                        luminanceSquares = m_HistoryLuminanceSquares[historyIndex];
+                        // Scaling keeps the mean and the variance estimate
+                        if (accumulated.a > maxHistory)
+                        {
+                            float scale = maxHistory / accumulated.a;
+                            accumulated *= scale;
+                            luminanceSquares *= scale;
+                        }
+                        tileReprojected++;
+                    }
+                    m_AccumulationData[index] = accumulated;
+                    m_LuminanceSquares[index] = luminanceSquares;
+                }
+            }
+        }
+
+        // The wavefront engine traces every sample of the tile up front, stage by stage
+        const glm::vec3* wavefrontColors = nullptr;
+        if (active && wavefront)
+        {
+            WavefrontBatch& batch = s_WavefrontBatch;
+            batch.Clear();
+            for (uint32_t y = minY; y < maxY; y++)
+            {
+                for (uint32_t x = minX; x < maxX; x++)
+                {
+                    auto sampleIndex = firstFrame ? 0u : (uint32_t)m_AccumulationData[x + y * width].a;
+                    for (uint32_t sample = 0; sample < samples; sample++)
+                        batch.Push(x, y, sampleIndex + sample);
+                }
+            }
+            TraceWavefront(batch);
+            wavefrontColors = batch.radiance.data();
+
+            for (uint32_t bounce = 0; bounce < WavefrontBatch::TimedBounces; bounce++)
+                traversalTime[bounce].fetch_add(batch.traversalTime[bounce], std::memory_order_relaxed);
+            sortTime.fetch_add(batch.sortTime, std::memory_order_relaxed);
+        }
+
+        for (uint32_t y = minY; y < maxY; y++)
+        {
+            for (uint32_t x = minX; x < maxX; x++)
+            {
+                // Accumulate, average, tonemap and pack in a single pass over the buffers
+                uint32_t index = x + y * width;
+                glm::vec4 accumulated = firstFrame ? glm::vec4(0.0f) : m_AccumulationData[index];
+                if (active)
+                {
+                    float luminanceSquares = firstFrame ? 0.0f : m_LuminanceSquares[index];
+                    auto sampleIndex = (uint32_t)accumulated.a;
+                    for (uint32_t sample = 0; sample < samples; sample++)
+                    {
+                        glm::vec4 color = wavefrontColors ? glm::vec4(*wavefrontColors++, 1.0f) : PerPixel(x, y, sampleIndex + sample);
+                        float luminance = Luminance(glm::vec3(color));
+                        accumulated += color;
+                        luminanceSquares += luminance * luminance;
+                    }
+                    m_AccumulationData[index] = accumulated;
+                    m_LuminanceSquares[index] = luminanceSquares;
+
+                    // Standard error of the mean from the unbiased sample variance
+                    float count = accumulated.a;
+                    float mean = Luminance(glm::vec3(accumulated)) / count;
+                    float variance = glm::max(luminanceSquares / count - mean * mean, 0.0f) * count / glm::max(count - 1.0f, 1.0f);
+                    if (count < minSamples || variance > threshold * threshold * count)
+                        converged = false;
+                }
+
+                glm::vec4 color;
+                if (showSampleCount)
+                    color = glm::vec4(glm::vec3(accumulated.a * inverseSampleBudget), 1.0f);
+                else
+                    color = glm::clamp(accumulated / accumulated.a, glm::vec4(0.0f), glm::vec4(1.0f));
+                pixels[x + y * width] = ConvertToRGBA(color);
+            }
+        }
+
+        if (active && adaptive)
+            m_ActiveTiles[tileIndex] = !converged;
+
+        rayCount.fetch_add(s_RayCount - tileRayStart, std::memory_order_relaxed);
+        pathLength.fetch_add(s_PathLength - tilePathStart, std::memory_order_relaxed);
+        reprojectedPixels.fetch_add(tileReprojected, std::memory_order_relaxed);
+    });
+
+    m_Statistics.rayCount = rayCount.load();
+    m_Statistics.renderTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+    m_Statistics.activeFraction = width * height > 0 ? (float)((double)activePixels / ((double)width * height)) : 0.0f;
+    m_Statistics.samplesPerPixel = activeTiles > 0 ? samples : 0;
+    m_Statistics.averagePathLength = activePixels > 0 ? (float)((double)pathLength.load() / ((double)activePixels * samples)) : 0.0f;
+    m_Statistics.reprojectedFraction = width * height > 0 ? (float)((double)reprojectedPixels.load() / ((double)width * height)) : 0.0f;
+    m_Statistics.previewLevel = 0;
+    for (uint32_t bounce = 0; bounce < WavefrontBatch::TimedBounces; bounce++)
+        m_Statistics.traversalTime[bounce] = (float)traversalTime[bounce].load() * 1e-6f;
+    m_Statistics.sortTime = (float)sortTime.load() * 1e-6f;
+    if (activePixels > 0)
+        m_FullFrameTime = m_Statistics.renderTime * (float)((double)width * height / ((double)activePixels * samples));
 
     if (m_Settings.accumulate)
         m_FrameIndex++;
     else
         m_FrameIndex = 1;
+    // The restart after a camera move above is not a new interaction
+    m_Restarted = false;
 }
 
 HitPayload Renderer::TraceRay(Ray ray) {
-    bool hasHit = false;
+    s_RayCount++;
     HitPayload hit{.distance = FLT_MAX};
 
-    for (int i = 0; i < m_Scene.spheres.size(); i++) {
-        Sphere& sphere = m_Scene.spheres[i];
-        glm::vec3 origin = ray.origin - sphere.position;
-
-        float a = glm::dot(ray.direction, ray.direction);
-        float b = 2.0f * glm::dot(origin, ray.direction);
-        float c = glm::dot(origin, origin) - sphere.radius * sphere.radius;
-
-        float discriminant = b * b - 4.0f * a * c;
-        if (discriminant < 0.0f)
-            continue;
-
-        float closestT = (-b - glm::sqrt(discriminant)) / (2.0f * a);
-
-        if (closestT > 0.0f && closestT < hit.distance) {
-            hit.distance = closestT;
-            hit.position = origin + ray.direction * hit.distance;
-            hit.normal = glm::normalize(hit.position);
-            hit.position += sphere.position;
-            hit.hitSphere = sphere;
-            hasHit = true;
-        }
-    }
-    if (!hasHit) {
+    uint32_t sphereIndex = 0;
+    if (!m_BVH.Intersect(ray, hit.distance, sphereIndex)) {
         hit.distance = -1.0f;
+        return hit;
     }
 
-
-    return hit;
+    return GetHitPayload(ray, m_Scene.spheres[sphereIndex], hit.distance);
 }
 
 
@@ -164,9 +815,10 @@ Camera::Camera(float verticalFOV, float nearClip, float farClip)
 {
     m_ForwardDirection = glm::vec3(0, 0, -1);
     m_Position = glm::vec3(0, 0, 6);
+    RecalculateView();
 }
 
-void Camera::Update(float ts)
+bool Camera::Update(float ts)
 {
     glm::vec2 mousePos(0.0f);
     SauronLT::Input::GetCursorPos(&mousePos.x, &mousePos.y);
@@ -175,7 +827,7 @@ void Camera::Update(float ts)
 
     if (!SauronLT::Input::IsMouseButtonDown(GLFW_MOUSE_BUTTON_RIGHT))
     {
-        return;
+        return false;
     }
 
     bool moved = false;
@@ -235,6 +887,19 @@ void Camera::Update(float ts)
         RecalculateView();
         RecalculateRayDirections();
     }
+
+    return moved;
+}
+
+void Camera::SetView(const glm::vec3& position, const glm::vec3& direction)
+{
+    if (position == m_Position && direction == m_ForwardDirection)
+        return;
+
+    m_Position = position;
+    m_ForwardDirection = direction;
+    RecalculateView();
+    RecalculateRayDirections();
 }
 
 void Camera::Resize(uint32_t width, uint32_t height)
@@ -266,8 +931,36 @@ void Camera::RecalculateView()
     m_InverseView = glm::inverse(m_View);
 }
 
+void Camera::SetRayMode(RayMode mode)
+{
+    if (mode == m_RayMode)
+        return;
+
+    m_RayMode = mode;
+    RecalculateRayDirections();
+}
+
 void Camera::RecalculateRayDirections()
 {
+    // Directions are affine in the pixel coordinate before normalization, so three corners give the whole basis
+    auto viewTarget = [this](float x, float y)
+    {
+        glm::vec4 target = m_InverseProjection * glm::vec4(x, y, 1, 1);
+        return glm::vec3(target) / target.w;
+    };
+    glm::vec3 corner = viewTarget(-1.0f, -1.0f);
+    glm::mat3 inverseViewRotation(m_InverseView);
+    m_RayCorner = inverseViewRotation * corner;
+    m_RayDeltaX = inverseViewRotation * ((viewTarget(1.0f, -1.0f) - corner) / (float)m_ViewportWidth);
+    m_RayDeltaY = inverseViewRotation * ((viewTarget(-1.0f, 1.0f) - corner) / (float)m_ViewportHeight);
+
+    if (m_RayMode == RayMode::Lazy)
+    {
+        m_RayDirections.clear();
+        m_RayDirections.shrink_to_fit();
+        return;
+    }
+
     m_RayDirections.resize(m_ViewportWidth * m_ViewportHeight);
 
     for (uint32_t y = 0; y < m_ViewportHeight; y++)
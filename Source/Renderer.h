@@ -3,6 +3,13 @@
 
 #include "SauronLT.h"
 #include "Random.h"
+#include "ThreadPool.h"
+#include "Scene.h"
+#include "BVH.h"
+#include "BSDF.h"
+#include "Sampler.h"
+#include "Wavefront.h"
+#include <chrono>
 #include <memory>
 #include <vector>
 #include <glm/gtc/matrix_transform.hpp>
@@ -10,42 +17,23 @@
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-struct Ray {
-    glm::vec3 origin;
-    glm::vec3 direction;
-};
-
-struct Material {
-    glm::vec3 albedo;
-    float roughness;
-    float metallic;
-};
-
-struct Sphere {
-    int materialIndex;
-    glm::vec3 position{0.0f};
-    float radius = 0.5f;
-};
-
-struct Scene {
-    std::vector<Sphere> spheres;
-    std::vector<Material> materials;
-};
-
-struct HitPayload {
-    glm::vec3 position;
-    glm::vec3 normal;
-    Sphere hitSphere;
-    float distance;
-};
-
 class Camera
 {
+public:
+    enum class RayMode
+    {
+        // One direction per pixel precomputed into m_RayDirections
+        Cached,
+        // Directions generated on demand from a corner + per-pixel delta basis, no per-pixel storage
+        Lazy
+    };
 public:
     Camera(float verticalFOV, float nearClip, float farClip);
 
-    void Update(float ts);
+    // Moves the camera from mouse and keyboard input, returns true if it moved
+    bool Update(float ts);
     void Resize(uint32_t width, uint32_t height);
+    void SetView(const glm::vec3& position, const glm::vec3& direction);
 
     const glm::mat4& GetProjection() const { return m_Projection; }
     const glm::mat4& GetInverseProjection() const { return m_InverseProjection; }
@@ -55,13 +43,27 @@ public:
     const glm::vec3& GetPosition() const { return m_Position; }
     const glm::vec3& GetDirection() const { return m_ForwardDirection; }
 
+    // Only filled in RayMode::Cached
     const std::vector<glm::vec3>& GetRayDirections() const { return m_RayDirections; }
 
+    // Works in both modes, jitter is the sub-pixel offset in [0, 1) and is ignored by the cached path
+    glm::vec3 GetRayDirection(uint32_t x, uint32_t y, const glm::vec2& jitter = glm::vec2(0.0f)) const
+    {
+        if (m_RayMode == RayMode::Cached)
+            return m_RayDirections[x + y * m_ViewportWidth];
+
+        return glm::normalize(m_RayCorner + ((float)x + jitter.x) * m_RayDeltaX + ((float)y + jitter.y) * m_RayDeltaY);
+    }
+
+    RayMode GetRayMode() const { return m_RayMode; }
+    void SetRayMode(RayMode mode);
+
     float GetRotationSpeed();
+
+    void RecalculateRayDirections();
 private:
     void RecalculateProjection();
     void RecalculateView();
-    void RecalculateRayDirections();
 
     glm::mat4 m_Projection{ 1.0f };
     glm::mat4 m_View{ 1.0f };
@@ -75,9 +77,16 @@ private:
     glm::vec3 m_Position{0.0f, 0.0f, 0.0f};
     glm::vec3 m_ForwardDirection{0.0f, 0.0f, 0.0f};
 
+    RayMode m_RayMode = RayMode::Lazy;
+
     // Cached ray directions
     std::vector<glm::vec3> m_RayDirections;
 
+    // World space direction through the corner of pixel (0, 0) and its change per pixel, not normalized
+    glm::vec3 m_RayCorner{0.0f};
+    glm::vec3 m_RayDeltaX{0.0f};
+    glm::vec3 m_RayDeltaY{0.0f};
+
     glm::vec2 m_LastMousePosition{ 0.0f, 0.0f };
     uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0;
 };
@@ -86,30 +95,179 @@ class Renderer {
 public:
     struct Settings {
         bool accumulate = true;
+        // 0 uses every hardware thread
+        uint32_t threadCount = 0;
+        uint32_t tileSize = 32;
+        // Generate primary rays per pixel instead of reading them from a cached array
+        bool lazyRays = true;
+        // Random sub-pixel offset for antialiasing, lazy rays only
+        bool jitter = true;
+        // Where the random numbers of pixel jitter, BSDF sampling and Russian roulette come from
+        Sampler::Type sampler = Sampler::Type::Sobol;
+        // Renders with different seeds have independent noise
+        uint32_t seed = 0;
+        // The original shading that reflects around a randomly offset normal, kept for comparison
+        bool legacyShading = false;
+        // Sample the BSDF lobes, uniform hemisphere directions otherwise
+        bool importanceSampling = true;
+        // Longest path, in rays from the camera
+        uint32_t maxBounces = 5;
+        // End paths at random by their throughput and weight the survivors up, unbiased
+        bool russianRoulette = true;
+        // Bounces every path takes before Russian roulette may end it
+        uint32_t rouletteMinBounces = 2;
+        // Number of extra Resize calls a new size has to survive before the buffers follow it
+        uint32_t resizeDebounce = 4;
+        // Stop sampling tiles whose pixels have converged and give their time to the others
+        bool adaptive = true;
+        // A pixel has converged once the standard error of its mean luminance drops below this
+        float adaptiveThreshold = 0.005f;
+        // Samples a pixel takes before its variance is trusted
+        uint32_t adaptiveMinSamples = 16;
+        // Upper bound of the samples an active pixel takes per frame
+        uint32_t adaptiveMaxSamples = 4;
+        // Show the per-pixel sample count instead of the image, brighter is more samples
+        bool showSampleCount = false;
+        // Carry the accumulated samples over into the new view when the camera moves or the viewport is resized,
+        // instead of starting again
+        bool reprojection = true;
+        // Reprojected pixels keep at most this many samples, so shading that depends on the view angle catches up
+        uint32_t reprojectionMaxSamples = 64;
+        // While the camera moves or the scene is edited, trace one pixel per 2x2 or 4x4 block if a full frame
+        // would not fit into the budget, and refine back to full resolution a level per frame afterwards
+        bool progressivePreview = true;
+        // ms a frame may take while interacting
+        float previewFrameBudget = 16.0f;
+        // Trace all samples of a tile together stage by stage (generate, intersect, shade, shadow) over
+        // structure-of-arrays queues, instead of one whole path at a time. Every ray still traverses the BVH on its
+        // own, only the spheres of a leaf are tested with SIMD. Same image, legacy shading excluded
+        bool wavefront = false;
+        // Wavefront only, order the rays after the first bounce by direction octant and then by the Morton code of their
+        // origin before intersecting them, so rays that visit the same BVH nodes are traced one after another
+        bool sortRays = true;
+    };
+
+    // Of the last Render call
+    struct Statistics {
+        uint64_t rayCount = 0;
+        float renderTime = 0.0f; // ms
+        // Of the pixels, sampled in this frame
+        float activeFraction = 1.0f;
+        // Taken by every sampled pixel
+        uint32_t samplesPerPixel = 1;
+        // Rays along the paths per sample, without shadow rays
+        float averagePathLength = 0.0f;
+        // Of the pixels, kept their samples through a camera move in this frame
+        float reprojectedFraction = 0.0f;
+        // Pixels were traced in blocks of 1 << previewLevel and not accumulated, 0 is full resolution
+        uint32_t previewLevel = 0;
+        // Wavefront only, ms of BVH traversal by bounce (shadow rays included) summed over the threads
+        float traversalTime[WavefrontBatch::TimedBounces] = {};
+        // Wavefront only, ms spent sorting rays summed over the threads
+        float sortTime = 0.0f;
     };
 public:
+    // Renders into a CPU framebuffer, showing it is up to the caller (see RenderThread)
     Renderer();
     ~Renderer() = default;
 
-    void Destroy();
-    std::shared_ptr<SauronLT::Image> GetImage();
+    uint32_t GetWidth() const { return m_Width; }
+    uint32_t GetHeight() const { return m_Height; }
+    // Packed RGBA8 average of the accumulated samples, row 0 is the bottom of the image
+    const uint32_t* GetImageData() const { return m_ImageData; }
+    // The pixels of the CPU framebuffer the last Render wrote, the rest kept what it showed.
+    // Empty when it rendered into a target, which is always written completely.
+    const std::vector<SauronLT::ImageRegion>& GetDirtyRegions() const { return m_DirtyRegions; }
+    // Sum of the samples of every pixel, alpha is their count
+    const glm::vec4* GetAccumulationData() const { return m_AccumulationData; }
+    uint32_t GetFrameIndex() const { return m_FrameIndex; }
+    const Statistics& GetStatistics() const { return m_Statistics; }
     void Resize(uint32_t width, uint32_t height);
-    void Render();
-    glm::vec4 PerPixel(uint32_t x, uint32_t y);
+    // Writes the frame into target (width * height packed pixels) if given, otherwise
+    // into the CPU framebuffer
+    void Render(uint32_t* target = nullptr);
+    // Alpha is 1, sampleIndex counts the samples the pixel took since the accumulation started
+    glm::vec4 PerPixel(uint32_t x, uint32_t y, uint32_t sampleIndex = 0);
     HitPayload TraceRay(Ray ray);
+    static uint32_t ConvertToRGBA(const glm::vec4& color);
     Scene& GetScene() { return m_Scene; }
+    Camera& GetCamera() { return m_Camera; }
+    // Call after editing the scene so the acceleration structure gets rebuilt
+    void InvalidateScene() { m_SceneDirty = true; }
+    const BVH::Statistics& GetBVHStatistics() const { return m_BVH.GetStatistics(); }
     Settings& GetSettings() { return m_Settings; }
-    void ResetFrameIndex() { m_FrameIndex = 0; }
+    void ResetFrameIndex() { m_FrameIndex = 1; m_Restarted = true; }
+private:
+    glm::vec3 TracePath(Ray ray, Sampler& sampler);
+    glm::vec3 TracePathLegacy(Ray ray, Sampler& sampler);
+    // Russian roulette after a bounce, false ends the path
+    bool ContinuePath(glm::vec3& throughput, uint32_t bounce, Sampler& sampler) const;
+    // Samples the next direction at a hit and applies Russian roulette, false ends the path.
+    // Shared by both engines so they make the same decisions from the same random numbers.
+    bool Scatter(const Material& material, const glm::vec3& normal, const glm::vec3& view, uint32_t bounce, Sampler& sampler,
+                 glm::vec3& throughput, glm::vec3& direction) const;
+    // TracePath for every path of the batch at once, the radiance of each path ends up in batch.radiance
+    void TraceWavefront(WavefrontBatch& batch);
+    // Surface position through the center of the pixel and the index of its sphere, or the ray direction and -1 for the sky
+    glm::vec4 TraceFirstHit(uint32_t x, uint32_t y);
+    // Finds the pixel that saw the same surface in the previous view, false if it was hidden, off screen or something else
+    bool Reproject(const glm::vec4& firstHit, uint32_t& historyIndex) const;
+    // One sample per block of 1 << level pixels, shown upscaled and kept out of the accumulation
+    void RenderPreview(uint32_t* target, uint32_t level);
 private:
     Settings m_Settings;
-    std::shared_ptr<SauronLT::Image> m_Image;
+    Statistics m_Statistics;
+    uint32_t m_Width = 0, m_Height = 0;
+    uint32_t m_PendingWidth = 0, m_PendingHeight = 0;
+    uint32_t m_ResizeRequests = 0;
     Scene m_Scene;
+    BVH m_BVH;
+    bool m_SceneDirty = true;
     Camera m_Camera;
+    ThreadPool m_ThreadPool;
 
+    // All hold m_Capacity pixels, the first m_Width * m_Height are in use
     glm::vec4* m_AccumulationData = nullptr;
+    // Sum of the squared sample luminance, for the variance of every pixel
+    float* m_LuminanceSquares = nullptr;
     uint32_t* m_ImageData = nullptr;
+    std::vector<SauronLT::ImageRegion> m_DirtyRegions;
+    // What the camera saw through the center of every pixel, for reprojection
+    glm::vec4* m_FirstHits = nullptr;
+    // The buffers above before the last camera move, swapped with them when it moves again
+    glm::vec4* m_HistoryAccumulation = nullptr;
+    float* m_HistoryLuminanceSquares = nullptr;
+    glm::vec4* m_HistoryFirstHits = nullptr;
+    uint32_t m_Capacity = 0;
+    // What the accumulation and the history are laid out for, the accumulation keeps the old size after a resize
+    // until the next frame reprojects it
+    uint32_t m_AccumulationWidth = 0, m_AccumulationHeight = 0;
+    uint32_t m_HistoryWidth = 0, m_HistoryHeight = 0;
+    // m_FirstHits belong to the current accumulation
+    bool m_FirstHitsValid = false;
+    // Of the camera the accumulation was rendered from
+    glm::mat4 m_PreviousViewProjection{1.0f};
+
+    // Of the last frame, preview or not, a change means the camera is being moved
+    glm::mat4 m_LastViewProjection{1.0f};
+    // ResetFrameIndex was called since the last frame
+    bool m_Restarted = true;
+    std::chrono::steady_clock::time_point m_LastInteraction;
+    uint32_t m_PreviewLevel = 0;
+    // ms of one sample for every pixel, from the last frame; 0 until measured
+    float m_FullFrameTime = 0.0f;
+
+    // One per tile, cleared once all of its pixels have converged
+    std::vector<uint8_t> m_ActiveTiles;
+    // Samples of a pixel that never converged, the maximum of the sample count view
+    uint32_t m_SampleBudget = 0;
+    bool m_ShowingSampleCount = false;
 
     uint32_t m_FrameIndex = 1;
+    // Never reset, advanced by the samples of every frame so no two accumulations share random numbers
+    uint32_t m_FrameCounter = 0;
+    // Of the current accumulation, the sampler sequences of all its samples start from it
+    uint32_t m_SequenceSeed = 0;
 };
 
 
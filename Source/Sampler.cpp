@@ -0,0 +1,337 @@
+#include "Sampler.h"
+#include "Random.h"
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+using SauronLT::Random;
+
+static constexpr uint32_t StratumCount = 16;
+static constexpr uint32_t BlueNoiseSize = 64;
+
+static float ToFloat(uint32_t x)
+{
+    return (float)(x >> 8) * 0x1p-24f;
+}
+
+static uint32_t ReverseBits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Hash that only lets a bit depend on the bits below it (Laine and Karras 2011, constants from Burley 2020),
+// applied to the reversed bits that makes it an Owen scramble
+static uint32_t NestedUniformScramble(uint32_t x, uint32_t seed)
+{
+    x = ReverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return ReverseBits(x);
+}
+
+// Random permutation of [0, length) picked by seed (Kensler 2013)
+static uint32_t Permute(uint32_t i, uint32_t length, uint32_t seed)
+{
+    uint32_t mask = length - 1;
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+    do
+    {
+        i ^= seed;
+        i *= 0xe170893du;
+        i ^= seed >> 16;
+        i ^= (i & mask) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3fu;
+        i ^= seed >> 23;
+        i ^= (i & mask) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & mask) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & mask) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & mask) >> 2;
+        i *= 0xc860a3dfu;
+        i &= mask;
+        i ^= i >> 5;
+    } while (i >= length);
+    return (i + seed) % length;
+}
+
+// Generator matrices of the first four Sobol dimensions, the rest is padded by shuffling the sample index
+using SobolMatrices = std::array<std::array<uint32_t, 32>, Sampler::DimensionsPerGroup>;
+
+static SobolMatrices BuildSobolMatrices()
+{
+    // Primitive polynomial degree, its coefficients and the initial direction numbers (Joe and Kuo 2008)
+    struct Polynomial { uint32_t degree; uint32_t coefficients; uint32_t initial[3]; };
+    const Polynomial polynomials[Sampler::DimensionsPerGroup - 1] = {
+            {1, 0, {1}},
+            {2, 1, {1, 3}},
+            {3, 1, {1, 3, 1}},
+    };
+
+    SobolMatrices matrices{};
+    for (uint32_t bit = 0; bit < 32; bit++)
+        matrices[0][bit] = 1u << (31 - bit);
+
+    for (uint32_t d = 1; d < Sampler::DimensionsPerGroup; d++)
+    {
+        const Polynomial& polynomial = polynomials[d - 1];
+        std::array<uint32_t, 32>& v = matrices[d];
+        for (uint32_t bit = 0; bit < 32; bit++)
+        {
+            if (bit < polynomial.degree)
+            {
+                v[bit] = polynomial.initial[bit] << (31 - bit);
+                continue;
+            }
+
+            uint32_t s = polynomial.degree;
+            v[bit] = v[bit - s] ^ (v[bit - s] >> s);
+            for (uint32_t k = 1; k < s; k++)
+            {
+                if ((polynomial.coefficients >> (s - 1 - k)) & 1)
+                    v[bit] ^= v[bit - k];
+            }
+        }
+    }
+    return matrices;
+}
+
+// The matrix product for every value of each byte of the index, shuffled indices use all 32 bits
+struct SobolTables {
+    uint32_t bytes[Sampler::DimensionsPerGroup][4][256];
+};
+
+static SobolTables BuildSobolTables()
+{
+    SobolMatrices matrices = BuildSobolMatrices();
+    SobolTables tables{};
+    for (uint32_t d = 0; d < Sampler::DimensionsPerGroup; d++)
+    {
+        for (uint32_t byte = 0; byte < 4; byte++)
+        {
+            for (uint32_t value = 0; value < 256; value++)
+            {
+                uint32_t result = 0;
+                for (uint32_t bit = 0; bit < 8; bit++)
+                {
+                    if (value & (1u << bit))
+                        result ^= matrices[d][byte * 8 + bit];
+                }
+                tables.bytes[d][byte][value] = result;
+            }
+        }
+    }
+    return tables;
+}
+
+static uint32_t Sobol(uint32_t index, uint32_t dimension)
+{
+    static const SobolTables s_Tables = BuildSobolTables();
+
+    const auto& bytes = s_Tables.bytes[dimension];
+    return bytes[0][index & 0xff] ^ bytes[1][(index >> 8) & 0xff] ^ bytes[2][(index >> 16) & 0xff] ^ bytes[3][index >> 24];
+}
+
+// Owen scrambled Sobol, padded to any dimension by giving every group of dimensions its own shuffle of the samples
+static uint32_t ScrambledSobol(uint32_t index, uint32_t dimension, uint32_t seed)
+{
+    uint32_t groupSeed = Random::Hash(seed ^ Random::Hash(dimension / Sampler::DimensionsPerGroup));
+    uint32_t shuffled = NestedUniformScramble(index, groupSeed);
+    uint32_t withinGroup = dimension % Sampler::DimensionsPerGroup;
+    return NestedUniformScramble(Sobol(shuffled, withinGroup), Random::Hash(groupSeed + withinGroup));
+}
+
+// Void-and-cluster (Ulichney 1993) on a torus: every pixel gets the rank at which it joins an evenly spread
+// pattern, so any threshold of the mask is a blue noise point set. Ranks are returned as 0.32 fixed point.
+static std::vector<uint32_t> GenerateBlueNoise(uint32_t size, uint64_t seed)
+{
+    const uint32_t count = size * size;
+    const float sigma = 1.5f;
+
+    // Gaussian energy of one point, by toroidal offset
+    std::vector<float> kernel(count);
+    for (uint32_t y = 0; y < size; y++)
+    {
+        for (uint32_t x = 0; x < size; x++)
+        {
+            float dx = (float)std::min(x, size - x);
+            float dy = (float)std::min(y, size - y);
+            kernel[x + y * size] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+        }
+    }
+
+    std::vector<uint8_t> pattern(count, 0);
+    std::vector<float> energy(count, 0.0f);
+    auto splat = [&](uint32_t index, float sign)
+    {
+        uint32_t px = index % size, py = index / size;
+        for (uint32_t y = 0; y < size; y++)
+        {
+            const float* row = &kernel[((y + size - py) % size) * size];
+            for (uint32_t x = 0; x < size; x++)
+                energy[x + y * size] += sign * row[(x + size - px) % size];
+        }
+    };
+    // Tightest cluster is the set pixel with the most energy, largest void the empty one with the least
+    auto find = [&](uint8_t value, bool highest)
+    {
+        uint32_t best = 0;
+        float bestEnergy = highest ? -FLT_MAX : FLT_MAX;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (pattern[i] != value)
+                continue;
+            if (highest ? energy[i] > bestEnergy : energy[i] < bestEnergy)
+            {
+                best = i;
+                bestEnergy = energy[i];
+            }
+        }
+        return best;
+    };
+
+    // Random initial points, spread out by moving the tightest cluster into the largest void until stable
+    SauronLT::PCG32 rng(seed);
+    uint32_t initialCount = count / 10;
+    for (uint32_t placed = 0; placed < initialCount;)
+    {
+        uint32_t index = rng.UInt() % count;
+        if (pattern[index])
+            continue;
+        pattern[index] = 1;
+        splat(index, 1.0f);
+        placed++;
+    }
+    for (uint32_t iteration = 0; iteration < count; iteration++)
+    {
+        uint32_t cluster = find(1, true);
+        pattern[cluster] = 0;
+        splat(cluster, -1.0f);
+        uint32_t hole = find(0, false);
+        pattern[hole] = 1;
+        splat(hole, 1.0f);
+        if (hole == cluster)
+            break;
+    }
+
+    std::vector<uint32_t> ranks(count, 0);
+    std::vector<uint8_t> initial = pattern;
+    std::vector<float> initialEnergy = energy;
+
+    // Ranks below the initial points, removing the tightest cluster each step
+    for (uint32_t rank = initialCount; rank-- > 0;)
+    {
+        uint32_t cluster = find(1, true);
+        pattern[cluster] = 0;
+        splat(cluster, -1.0f);
+        ranks[cluster] = rank;
+    }
+
+    // And above them, filling the largest void each step
+    pattern = initial;
+    energy = initialEnergy;
+    for (uint32_t rank = initialCount; rank < count; rank++)
+    {
+        uint32_t hole = find(0, false);
+        pattern[hole] = 1;
+        splat(hole, 1.0f);
+        ranks[hole] = rank;
+    }
+
+    std::vector<uint32_t> mask(count);
+    for (uint32_t i = 0; i < count; i++)
+        mask[i] = (uint32_t)(((((uint64_t)ranks[i] << 1) + 1) << 31) / count);
+    return mask;
+}
+
+Sampler::Sampler(Type type, uint32_t x, uint32_t y, uint32_t pixelIndex, uint32_t sampleIndex, uint32_t seed)
+        : m_Type(type), m_X(x), m_Y(y), m_PixelIndex(pixelIndex), m_SampleIndex(sampleIndex), m_Seed(seed),
+          m_PixelSeed(Random::Hash(pixelIndex ^ Random::Hash(seed)))
+{
+}
+
+float Sampler::Get1D()
+{
+    return Sample(m_Dimension++);
+}
+
+glm::vec2 Sampler::Get2D()
+{
+    uint32_t dimension = m_Dimension;
+    m_Dimension += 2;
+
+    if (m_Type == Type::Stratified)
+    {
+        // One of 4x4 cells, each cell once every 16 samples
+        uint32_t stratum = GetStratum(dimension);
+        SauronLT::PCG32 rng = Random::Stream(m_PixelIndex, m_Seed + m_SampleIndex, dimension);
+        float u = rng.Float();
+        float v = rng.Float();
+        return {((float)(stratum % 4) + u) * 0.25f, ((float)(stratum / 4) + v) * 0.25f};
+    }
+
+    return {Sample(dimension), Sample(dimension + 1)};
+}
+
+float Sampler::Sample(uint32_t dimension) const
+{
+    switch (m_Type)
+    {
+        case Type::Independent:
+            return Random::Stream(m_PixelIndex, m_Seed + m_SampleIndex, dimension).Float();
+        case Type::Stratified:
+        {
+            float jitter = Random::Stream(m_PixelIndex, m_Seed + m_SampleIndex, dimension).Float();
+            return std::min(((float)GetStratum(dimension) + jitter) / (float)StratumCount, 0x1.fffffep-1f);
+        }
+        case Type::Sobol:
+            return ToFloat(ScrambledSobol(m_SampleIndex, dimension, m_PixelSeed));
+        case Type::BlueNoise:
+        {
+            static const std::vector<uint32_t> s_Mask = GenerateBlueNoise(BlueNoiseSize, 0x5eed);
+
+            // Every pixel walks the same Sobol sequence, rotated by the mask. Neighbouring pixels get far apart
+            // rotations, so their errors differ and are spread as blue noise over the screen.
+            // The mask is shifted differently for every dimension, the fixed point addition wraps around exactly.
+            uint32_t offset = Random::Hash(Random::Hash(m_Seed) ^ dimension);
+            uint32_t x = (m_X + offset) % BlueNoiseSize;
+            uint32_t y = (m_Y + (offset >> 16)) % BlueNoiseSize;
+            return ToFloat(ScrambledSobol(m_SampleIndex, dimension, m_Seed) + s_Mask[x + y * BlueNoiseSize]);
+        }
+    }
+    return 0.0f;
+}
+
+uint32_t Sampler::GetStratum(uint32_t dimension) const
+{
+    uint32_t cycle = m_SampleIndex / StratumCount;
+    return Permute(m_SampleIndex % StratumCount, StratumCount, Random::Hash(m_PixelSeed ^ Random::Hash(dimension + cycle * 65537u)));
+}
+
+const char* Sampler::GetName(Type type)
+{
+    switch (type)
+    {
+        case Type::Independent: return "independent";
+        case Type::Stratified: return "stratified";
+        case Type::Sobol: return "sobol";
+        case Type::BlueNoise: return "bluenoise";
+    }
+    return "";
+}
@@ -0,0 +1,53 @@
+#ifndef RTX_SAMPLER_H
+#define RTX_SAMPLER_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// The random numbers of one sample of one pixel. Every number has a fixed dimension, so the same decision
+// sees the same dimension in every sample no matter which branches the path took before it: the camera
+// uses the first group of DimensionsPerGroup, each bounce the group after.
+// Everything is a pure function of (pixel, sample index, seed, dimension), nothing is shared between threads.
+class Sampler
+{
+public:
+    enum class Type
+    {
+        // Uncorrelated pseudo-random numbers
+        Independent,
+        // Jittered 16 strata per dimension (4x4 for pairs), newly shuffled every 16 samples
+        Stratified,
+        // Sobol with hash-based Owen scrambling, padded over dimension groups (Burley 2020)
+        Sobol,
+        // One scrambled Sobol sequence for all pixels, rotated per pixel by a tiled void-and-cluster mask.
+        // The error is blue noise on screen, which looks less noisy at the same sample count
+        BlueNoise
+    };
+
+    static constexpr uint32_t DimensionsPerGroup = 4;
+public:
+    Sampler(Type type, uint32_t x, uint32_t y, uint32_t pixelIndex, uint32_t sampleIndex, uint32_t seed);
+
+    void SetDimension(uint32_t dimension) { m_Dimension = dimension; }
+    // [0, 1)
+    float Get1D();
+    // Two consecutive dimensions, stratified jointly where the type supports it
+    glm::vec2 Get2D();
+
+    static const char* GetName(Type type);
+private:
+    float Sample(uint32_t dimension) const;
+    // Stratified only, which of the strata the current sample falls into
+    uint32_t GetStratum(uint32_t dimension) const;
+private:
+    Type m_Type;
+    uint32_t m_X, m_Y;
+    uint32_t m_PixelIndex;
+    uint32_t m_SampleIndex;
+    uint32_t m_Seed;
+    // Per pixel, decorrelates the scrambles of neighbouring pixels
+    uint32_t m_PixelSeed;
+    uint32_t m_Dimension = 0;
+};
+
+#endif //RTX_SAMPLER_H
@@ -1,5 +1,23 @@
 #include <vector>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <thread>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include "SauronLT.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -35,17 +53,36 @@ namespace SauronLT {
     static VkQueue                  s_Queue = VK_NULL_HANDLE;
     static VkDebugReportCallbackEXT s_DebugReport = VK_NULL_HANDLE;
     static VkPipelineCache          s_PipelineCache = VK_NULL_HANDLE;
+    static std::string              s_PipelineCachePath;
+    // Init time of the run that created the cache file, 0 if nothing valid was loaded
+    static float                    s_ColdInitTime = 0.0f;
+    static float                    s_InitTime = 0.0f;
     static VkDescriptorPool         s_DescriptorPool = VK_NULL_HANDLE;
+    static VkCommandPool            s_UploadCommandPool = VK_NULL_HANDLE;
+    static VkDeviceSize             s_NonCoherentAtomSize = 1;
+    static VkPhysicalDeviceMemoryProperties s_MemoryProperties;
 
     static ImGui_ImplVulkanH_Window s_MainWindowData;
     static int                      s_MinImageCount = 2;
     static bool                     s_SwapChainRebuild = false;
+    static PresentMode              s_PresentMode = PresentMode::Fifo;
+    static float                    s_FrameLimit = 0.0f;
+    static std::chrono::steady_clock::time_point s_LastFrameStart;
+    // When input was polled for the current frame, the input what it shows reflects, and that of the frame
+    // last rendered to every swapchain image
+    static double                   s_InputTime = 0.0;
+    static double                   s_FrameInputTime = 0.0;
+    static std::vector<double>      s_ImageInputTime;
+    static float                    s_InputLatency = 0.0f;
     static GLFWwindow*              s_Window = nullptr;
 
     static bool                     s_Initialized = false;
     static ImVec4                   s_BackgroundColor;
     static                          std::vector<std::vector<std::function<void()>>> s_ResourceFreeQueue;
 
+    static void DestroyDeviceMemory();
+    static void StopImageLoader();
+
 
     // HELPER
     static VkCommandPool GetCurrentCommandPool() {
@@ -60,6 +97,69 @@ namespace SauronLT {
         return !glfwWindowShouldClose(s_Window);
     }
 
+    void SetPresentMode(PresentMode mode) {
+        if (mode == s_PresentMode)
+            return;
+        s_PresentMode = mode;
+        s_SwapChainRebuild = true;
+    }
+
+    PresentMode GetPresentMode() {
+        return s_PresentMode;
+    }
+
+    PresentMode GetActivePresentMode() {
+        switch (s_MainWindowData.PresentMode)
+        {
+            case VK_PRESENT_MODE_MAILBOX_KHR: return PresentMode::Mailbox;
+            case VK_PRESENT_MODE_IMMEDIATE_KHR: return PresentMode::Immediate;
+            default: return PresentMode::Fifo;
+        }
+    }
+
+    const char* GetPresentModeName(PresentMode mode) {
+        switch (mode)
+        {
+            case PresentMode::Fifo: return "FIFO";
+            case PresentMode::Mailbox: return "Mailbox";
+            case PresentMode::Immediate: return "Immediate";
+        }
+        return "";
+    }
+
+    void SetSwapchainImageCount(uint32_t count) {
+        // ImGui's Vulkan backend needs at least two
+        int minImageCount = (int)std::max(count, 2u);
+        if (minImageCount == s_MinImageCount)
+            return;
+        s_MinImageCount = minImageCount;
+        s_SwapChainRebuild = true;
+    }
+
+    uint32_t GetSwapchainImageCount() {
+        return s_MainWindowData.ImageCount;
+    }
+
+    void SetFrameLimit(float framesPerSecond) {
+        s_FrameLimit = std::max(framesPerSecond, 0.0f);
+    }
+
+    float GetFrameLimit() {
+        return s_FrameLimit;
+    }
+
+    double GetInputTime() {
+        return s_InputTime;
+    }
+
+    void SetFrameInputTime(double time) {
+        s_FrameInputTime = time;
+    }
+
+    float GetInputLatency() {
+        return s_InputLatency;
+    }
+
     void SetBackground(const ImVec4& color) {
 //        s_MainWindowData.ClearValue.color.float32[0] = color.x;
 //        s_MainWindowData.ClearValue.color.float32[1] = color.y;
@@ -152,6 +252,11 @@ namespace SauronLT {
 
             s_PhysicalDevice = gpus[use_gpu];
             free(gpus);
+
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(s_PhysicalDevice, &properties);
+            s_NonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+            vkGetPhysicalDeviceMemoryProperties(s_PhysicalDevice, &s_MemoryProperties);
         }
 
         // Select graphics queue family
@@ -220,9 +325,119 @@ namespace SauronLT {
             VK_CHECK_RETURN_FALSE_MSG_IF(err, "Failed to create Descriptor Pool.");
         }
 
+        // Create Command Pool for image uploads, its command buffers are reset and re-recorded individually
+        {
+            VkCommandPoolCreateInfo pool_info = {};
+            pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            pool_info.queueFamilyIndex = s_QueueFamily;
+            err = vkCreateCommandPool(s_Device, &pool_info, s_Allocator, &s_UploadCommandPool);
+            VK_CHECK_RETURN_FALSE_MSG_IF(err, "Failed to create upload Command Pool.");
+        }
+
+        return true;
+    }
+
+    // PIPELINE CACHE
+
+    // Precedes the driver's cache data in the file. The driver validates its own header as well,
+    // but a mismatch there only shows up as a slow start, so reject stale files up front.
+    struct PipelineCacheFileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        float coldInitTime; // ms
+        uint64_t dataSize;
+    };
+
+    static constexpr uint32_t s_PipelineCacheMagic = 0x50585452; // "RTXP"
+    static constexpr uint32_t s_PipelineCacheVersion = 1;
+
+    static PipelineCacheFileHeader GetPipelineCacheHeader()
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(s_PhysicalDevice, &properties);
+
+        PipelineCacheFileHeader header = {};
+        header.magic = s_PipelineCacheMagic;
+        header.version = s_PipelineCacheVersion;
+        header.vendorID = properties.vendorID;
+        header.deviceID = properties.deviceID;
+        header.driverVersion = properties.driverVersion;
+        memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+        return header;
+    }
+
+    static bool CreatePipelineCache()
+    {
+        std::vector<char> data;
+
+        std::ifstream file(s_PipelineCachePath, std::ios::binary);
+        PipelineCacheFileHeader header = {};
+        if (file && file.read((char*)&header, sizeof(header)))
+        {
+            PipelineCacheFileHeader expected = GetPipelineCacheHeader();
+            bool valid = header.magic == expected.magic && header.version == expected.version &&
+                         header.vendorID == expected.vendorID && header.deviceID == expected.deviceID &&
+                         header.driverVersion == expected.driverVersion &&
+                         memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+
+            data.resize(valid ? header.dataSize : 0);
+            if (valid && file.read(data.data(), (std::streamsize)data.size()))
+                s_ColdInitTime = header.coldInitTime;
+            else
+            {
+                std::cerr << "[WARNING] Ignoring outdated pipeline cache " << s_PipelineCachePath << "." << std::endl;
+                data.clear();
+            }
+        }
+
+        VkPipelineCacheCreateInfo cache_info = {};
+        cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cache_info.initialDataSize = data.size();
+        cache_info.pInitialData = data.empty() ? nullptr : data.data();
+        VkResult err = vkCreatePipelineCache(s_Device, &cache_info, s_Allocator, &s_PipelineCache);
+        VK_CHECK_RETURN_FALSE_MSG_IF(err, "Failed to create Pipeline Cache.");
         return true;
     }
 
+    static void SavePipelineCache()
+    {
+        size_t size = 0;
+        VkResult err = vkGetPipelineCacheData(s_Device, s_PipelineCache, &size, nullptr);
+        VK_CHECK_RETURN_MSG_IF(err, "Failed to read Pipeline Cache.")
+        std::vector<char> data(size);
+        err = vkGetPipelineCacheData(s_Device, s_PipelineCache, &size, data.data());
+        VK_CHECK_RETURN_MSG_IF(err, "Failed to read Pipeline Cache.")
+
+        // Keep the time of the first cold start so later runs can compare against it
+        PipelineCacheFileHeader header = GetPipelineCacheHeader();
+        header.coldInitTime = s_ColdInitTime > 0.0f ? s_ColdInitTime : s_InitTime;
+        header.dataSize = size;
+
+        std::ofstream file(s_PipelineCachePath, std::ios::binary | std::ios::trunc);
+        RETURN_MSG_IF(!file, "Failed to write pipeline cache " << s_PipelineCachePath << ".")
+        file.write((const char*)&header, sizeof(header));
+        file.write(data.data(), (std::streamsize)size);
+    }
+
+    // The requested mode or the next best the surface supports, FIFO is always there
+    static VkPresentModeKHR SelectPresentMode()
+    {
+        std::vector<VkPresentModeKHR> present_modes;
+        if (s_PresentMode == PresentMode::Immediate)
+            present_modes.push_back(VK_PRESENT_MODE_IMMEDIATE_KHR);
+        if (s_PresentMode != PresentMode::Fifo)
+            present_modes.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
+        present_modes.push_back(VK_PRESENT_MODE_FIFO_KHR);
+
+        return ImGui_ImplVulkanH_SelectPresentMode(s_PhysicalDevice, s_MainWindowData.Surface, present_modes.data(), (int)present_modes.size());
+    }
+
     static bool SetupVulkanWindow(VkSurfaceKHR surface, int width, int height)
     {
         s_MainWindowData.Surface = surface;
@@ -237,9 +452,7 @@ namespace SauronLT {
         const VkColorSpaceKHR requestSurfaceColorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
         s_MainWindowData.SurfaceFormat = ImGui_ImplVulkanH_SelectSurfaceFormat(s_PhysicalDevice, s_MainWindowData.Surface, requestSurfaceImageFormat, (size_t)IM_ARRAYSIZE(requestSurfaceImageFormat), requestSurfaceColorSpace);
 
-        VkPresentModeKHR present_modes[] = { VK_PRESENT_MODE_FIFO_KHR };
-
-        s_MainWindowData.PresentMode = ImGui_ImplVulkanH_SelectPresentMode(s_PhysicalDevice, s_MainWindowData.Surface, &present_modes[0], IM_ARRAYSIZE(present_modes));
+        s_MainWindowData.PresentMode = SelectPresentMode();
 
         ImGui_ImplVulkanH_CreateOrResizeWindow(s_Instance, s_PhysicalDevice, s_Device, &s_MainWindowData, s_QueueFamily, s_Allocator, width, height, s_MinImageCount);
 
@@ -249,6 +462,8 @@ namespace SauronLT {
     void Init(int windowWidth, int windowHeight, const char* appName) {
         RETURN_MSG_IF(s_Initialized, "Sauron can't be initialized twice.")
 
+        auto startTime = std::chrono::high_resolution_clock::now();
+
         // Setup GLFW window
         glfwSetErrorCallback(glfw_error_callback);
         if (!glfwInit()) {
@@ -260,6 +475,10 @@ namespace SauronLT {
         s_Window = glfwCreateWindow(windowWidth, windowHeight, appName, nullptr, nullptr);
         RETURN_MSG_IF(!SetupVulkan(), "Failed to set up Vulkan.")
 
+        // Pipelines compiled by ImGui (also for extra viewports) are reused across runs
+        s_PipelineCachePath = std::string(appName) + ".pipelinecache";
+        RETURN_MSG_IF(!CreatePipelineCache(), "Failed to set up Vulkan.")
+
         // Create Window Surface
         VkSurfaceKHR surface;
         VkResult err = glfwCreateWindowSurface(s_Instance, s_Window, s_Allocator, &surface);
@@ -309,7 +528,7 @@ namespace SauronLT {
         init_info.CheckVkResultFn = check_vk_result;
         ImGui_ImplVulkan_Init(&init_info, s_MainWindowData.RenderPass);
 
-        s_ResourceFreeQueue.resize(s_MinImageCount);
+        s_ResourceFreeQueue.resize(s_MainWindowData.ImageCount);
 
         ImFontConfig fontConfig;
         fontConfig.FontDataOwnedByAtlas = false;
@@ -348,6 +567,12 @@ namespace SauronLT {
 
         std::cout << "Successfully initialized Vulkan.\n";
         s_Initialized = true;
+
+        s_InitTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+        if (s_ColdInitTime > 0.0f)
+            std::cout << "Startup took " << s_InitTime << "ms with the pipeline cache, " << s_ColdInitTime - s_InitTime << "ms less than without it.\n";
+        else
+            std::cout << "Startup took " << s_InitTime << "ms, no pipeline cache yet.\n";
     }
 
 
@@ -359,6 +584,8 @@ namespace SauronLT {
         VkResult err = vkDeviceWaitIdle(s_Device);
         check_vk_result(err);
 
+        StopImageLoader();
+
         // Free resources in queue
         for (auto& queue : s_ResourceFreeQueue)
         {
@@ -373,6 +600,11 @@ namespace SauronLT {
 
         ImGui_ImplVulkanH_DestroyWindow(s_Instance, s_Device, &s_MainWindowData, s_Allocator);
 
+        SavePipelineCache();
+        vkDestroyPipelineCache(s_Device, s_PipelineCache, s_Allocator);
+
+        vkDestroyCommandPool(s_Device, s_UploadCommandPool, s_Allocator);
+        DestroyDeviceMemory();
         vkDestroyDescriptorPool(s_Device, s_DescriptorPool, s_Allocator);
 
     #ifdef IMGUI_VULKAN_DEBUG_REPORT
@@ -403,6 +635,16 @@ namespace SauronLT {
         }
         VK_CHECK_RETURN_MSG_IF(err, "Failed to acquire next image.")
 
+        // The image is free again, so what was last rendered to it has been on screen and got replaced
+        if (s_ImageInputTime.size() < s_MainWindowData.ImageCount)
+            s_ImageInputTime.resize(s_MainWindowData.ImageCount, 0.0);
+        double& image_input_time = s_ImageInputTime[s_MainWindowData.FrameIndex];
+        if (image_input_time > 0.0)
+        {
+            auto latency = (float)((glfwGetTime() - image_input_time) * 1000.0);
+            s_InputLatency = s_InputLatency > 0.0f ? s_InputLatency + (latency - s_InputLatency) * 0.05f : latency;
+        }
+        image_input_time = s_FrameInputTime;
 
         ImGui_ImplVulkanH_Frame* fd = &s_MainWindowData.Frames[s_MainWindowData.FrameIndex];
         {
@@ -487,7 +729,23 @@ namespace SauronLT {
     }
 
     void BeginFrame() {
+        // Waiting before polling keeps the input as fresh as possible
+        if (s_FrameLimit > 0.0f)
+        {
+            auto frame_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / s_FrameLimit));
+            auto next_frame = s_LastFrameStart + frame_time;
+            // Sleeping is only accurate to a millisecond or worse, the rest is spun
+            auto sleep_until = next_frame - std::chrono::milliseconds(1);
+            if (std::chrono::steady_clock::now() < sleep_until)
+                std::this_thread::sleep_until(sleep_until);
+            while (std::chrono::steady_clock::now() < next_frame)
+                std::this_thread::yield();
+        }
+        s_LastFrameStart = std::chrono::steady_clock::now();
+
         glfwPollEvents();
+        s_InputTime = glfwGetTime();
+        s_FrameInputTime = s_InputTime;
 
         // Resize swap chain?
         if (s_SwapChainRebuild)
@@ -496,14 +754,29 @@ namespace SauronLT {
             glfwGetFramebufferSize(s_Window, &width, &height);
             if (width > 0 && height > 0)
             {
+                s_MainWindowData.PresentMode = SelectPresentMode();
                 ImGui_ImplVulkan_SetMinImageCount(s_MinImageCount);
                 ImGui_ImplVulkanH_CreateOrResizeWindow(s_Instance, s_PhysicalDevice, s_Device, &s_MainWindowData,
                                                        s_QueueFamily, s_Allocator, width, height, s_MinImageCount);
                 s_MainWindowData.FrameIndex = 0;
                 s_SwapChainRebuild = false;
+
+                // Deferred frees are indexed by swapchain image. Rebuilding waited for the device to go idle, so
+                // everything queued can go now, slots past a smaller image count would never be reached again.
+                for (auto& queue : s_ResourceFreeQueue)
+                {
+                    for (auto& func : queue)
+                        func();
+                    queue.clear();
+                }
+                s_ResourceFreeQueue.resize(s_MainWindowData.ImageCount);
+                // The new images were never shown
+                s_ImageInputTime.assign(s_MainWindowData.ImageCount, 0.0);
             }
         }
 
+        Image::UploadLoadedImages();
+
         ImGui_ImplVulkan_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
@@ -566,6 +839,204 @@ namespace SauronLT {
         return s_Window;
     }
 
+    // DEVICE MEMORY
+
+    // Resources are sub-allocated from large blocks per memory type instead of getting one
+    // vkAllocateMemory each. Buffers and images never share a block, so bufferImageGranularity
+    // can be ignored. Host visible blocks are mapped once for their whole lifetime.
+    struct MemoryBlock
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        char* mapped = nullptr;
+        uint32_t memoryType = 0;
+        bool linear = false;
+        // Holds a single allocation that did not fit a regular block
+        bool dedicated = false;
+        // Offset -> size of every free range, neighbours are merged when freeing
+        std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+    };
+
+    static constexpr VkDeviceSize s_MemoryBlockSize = 64ull * 1024 * 1024;
+    // Indices are handed out in MemoryAllocation::block, so freed blocks leave a hole that gets reused
+    static std::vector<MemoryBlock> s_MemoryBlocks;
+    static std::mutex s_MemoryMutex;
+
+    static uint32_t GetVulkanMemoryType(VkMemoryPropertyFlags properties, uint32_t type_bits)
+    {
+        for (uint32_t i = 0; i < s_MemoryProperties.memoryTypeCount; i++)
+        {
+            if ((s_MemoryProperties.memoryTypes[i].propertyFlags & properties) == properties && type_bits & (1 << i))
+                return i;
+        }
+
+        return 0xffffffff;
+    }
+
+    static bool CreateMemoryBlock(MemoryBlock& block, VkDeviceSize size, uint32_t memoryType, bool linear, bool dedicated)
+    {
+        VkMemoryAllocateInfo alloc_info = {};
+        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        alloc_info.allocationSize = size;
+        alloc_info.memoryTypeIndex = memoryType;
+        VkResult err = vkAllocateMemory(s_Device, &alloc_info, s_Allocator, &block.memory);
+        VK_CHECK_RETURN_FALSE_MSG_IF(err, "Failed to allocate a device memory block.");
+
+        if (s_MemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        {
+            err = vkMapMemory(s_Device, block.memory, 0, VK_WHOLE_SIZE, 0, (void**)(&block.mapped));
+            check_vk_result(err);
+        }
+
+        block.size = size;
+        block.memoryType = memoryType;
+        block.linear = linear;
+        block.dedicated = dedicated;
+        block.freeRanges.clear();
+        if (!dedicated)
+            block.freeRanges[0] = size;
+        return true;
+    }
+
+    static void DestroyMemoryBlock(MemoryBlock& block)
+    {
+        if (block.mapped)
+            vkUnmapMemory(s_Device, block.memory);
+        vkFreeMemory(s_Device, block.memory, s_Allocator);
+        block = {};
+    }
+
+    // First fit inside the block, returns false if no free range is large enough
+    static bool SubAllocate(MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+    {
+        for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it)
+        {
+            VkDeviceSize rangeStart = it->first;
+            VkDeviceSize rangeEnd = it->first + it->second;
+            VkDeviceSize alignedStart = (rangeStart + alignment - 1) / alignment * alignment;
+            if (alignedStart + size > rangeEnd)
+                continue;
+
+            block.freeRanges.erase(it);
+            if (alignedStart > rangeStart)
+                block.freeRanges[rangeStart] = alignedStart - rangeStart;
+            if (alignedStart + size < rangeEnd)
+                block.freeRanges[alignedStart + size] = rangeEnd - (alignedStart + size);
+            offset = alignedStart;
+            return true;
+        }
+        return false;
+    }
+
+    static MemoryAllocation AllocateDeviceMemory(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear)
+    {
+        MemoryAllocation allocation;
+
+        uint32_t memoryType = GetVulkanMemoryType(properties, requirements.memoryTypeBits);
+        if (memoryType == 0xffffffff)
+        {
+            std::cerr << "[VULKAN ERROR] No memory type with properties " << properties << "." << std::endl;
+            return allocation;
+        }
+
+        // Mapped ranges get flushed, so keep host visible allocations on whole atoms
+        VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+        if (s_MemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+            alignment = std::max(alignment, s_NonCoherentAtomSize);
+        VkDeviceSize size = (requirements.size + alignment - 1) / alignment * alignment;
+
+        std::lock_guard<std::mutex> lock(s_MemoryMutex);
+
+        uint32_t blockIndex = 0xffffffff;
+        VkDeviceSize offset = 0;
+        for (uint32_t i = 0; i < s_MemoryBlocks.size(); i++)
+        {
+            MemoryBlock& block = s_MemoryBlocks[i];
+            if (block.memory && !block.dedicated && block.memoryType == memoryType && block.linear == linear &&
+                SubAllocate(block, size, alignment, offset))
+            {
+                blockIndex = i;
+                break;
+            }
+        }
+
+        if (blockIndex == 0xffffffff)
+        {
+            blockIndex = 0;
+            while (blockIndex < s_MemoryBlocks.size() && s_MemoryBlocks[blockIndex].memory)
+                blockIndex++;
+            if (blockIndex == s_MemoryBlocks.size())
+                s_MemoryBlocks.emplace_back();
+
+            // Anything larger than half a block would mostly waste the rest of it
+            bool dedicated = size > s_MemoryBlockSize / 2;
+            MemoryBlock& block = s_MemoryBlocks[blockIndex];
+            if (!CreateMemoryBlock(block, dedicated ? size : s_MemoryBlockSize, memoryType, linear, dedicated))
+                return allocation;
+            if (!dedicated)
+                SubAllocate(block, size, alignment, offset);
+        }
+
+        const MemoryBlock& block = s_MemoryBlocks[blockIndex];
+        allocation.memory = block.memory;
+        allocation.offset = offset;
+        allocation.size = size;
+        allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+        allocation.block = blockIndex;
+        return allocation;
+    }
+
+    static void FreeDeviceMemory(const MemoryAllocation& allocation)
+    {
+        if (!allocation.memory)
+            return;
+
+        std::lock_guard<std::mutex> lock(s_MemoryMutex);
+
+        MemoryBlock& block = s_MemoryBlocks[allocation.block];
+        if (block.dedicated)
+            return DestroyMemoryBlock(block);
+
+        VkDeviceSize start = allocation.offset;
+        VkDeviceSize end = allocation.offset + allocation.size;
+        auto next = block.freeRanges.lower_bound(start);
+        if (next != block.freeRanges.end() && next->first == end)
+        {
+            end += next->second;
+            next = block.freeRanges.erase(next);
+        }
+        if (next != block.freeRanges.begin())
+        {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == start)
+            {
+                start = previous->first;
+                block.freeRanges.erase(previous);
+            }
+        }
+        block.freeRanges[start] = end - start;
+
+        // Keep one empty block of each kind around so resizing does not hit the driver every time
+        if (block.freeRanges.size() != 1 || block.freeRanges.begin()->second != block.size)
+            return;
+        for (const MemoryBlock& other : s_MemoryBlocks)
+        {
+            if (&other != &block && other.memory && !other.dedicated && other.memoryType == block.memoryType &&
+                other.linear == block.linear && other.freeRanges.size() == 1 && other.freeRanges.begin()->second == other.size)
+                return DestroyMemoryBlock(block);
+        }
+    }
+
+    static void DestroyDeviceMemory()
+    {
+        for (MemoryBlock& block : s_MemoryBlocks)
+        {
+            if (block.memory)
+                DestroyMemoryBlock(block);
+        }
+        s_MemoryBlocks.clear();
+    }
+
     // IMAGE
 
     static uint32_t BytesPerPixel(ImageFormat format)
@@ -590,41 +1061,407 @@ namespace SauronLT {
         return (VkFormat)0;
     }
 
-    static uint32_t GetVulkanMemoryType(VkMemoryPropertyFlags properties, uint32_t type_bits)
+    // IMAGE LOADING
+
+    // Read-only mapping of a whole file, decoding then reads straight from the page cache
+    class MappedFile
     {
-        VkPhysicalDeviceMemoryProperties prop;
-        vkGetPhysicalDeviceMemoryProperties(s_PhysicalDevice, &prop);
-        for (uint32_t i = 0; i < prop.memoryTypeCount; i++)
+    public:
+        explicit MappedFile(const std::string& path)
         {
-            if ((prop.memoryTypes[i].propertyFlags & properties) == properties && type_bits & (1 << i))
-                return i;
+#ifdef _WIN32
+            m_File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (m_File == INVALID_HANDLE_VALUE)
+                return;
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(m_File, &size) || size.QuadPart == 0)
+                return;
+            m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!m_Mapping)
+                return;
+            m_Data = MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+            if (m_Data)
+                m_Size = (size_t)size.QuadPart;
+#else
+            int file = open(path.c_str(), O_RDONLY);
+            if (file < 0)
+                return;
+            struct stat info = {};
+            if (fstat(file, &info) == 0 && info.st_size > 0)
+            {
+                void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+                if (data != MAP_FAILED)
+                {
+                    m_Data = data;
+                    m_Size = (size_t)info.st_size;
+                }
+            }
+            // The mapping keeps its own reference to the file
+            close(file);
+#endif
         }
 
-        return 0xffffffff;
-    }
+        ~MappedFile()
+        {
+#ifdef _WIN32
+            if (m_Data)
+                UnmapViewOfFile(m_Data);
+            if (m_Mapping)
+                CloseHandle(m_Mapping);
+            if (m_File != INVALID_HANDLE_VALUE)
+                CloseHandle(m_File);
+#else
+            if (m_Data)
+                munmap(m_Data, m_Size);
+#endif
+        }
 
-    Image::Image(const std::string& path)
-            : m_Filepath(path)
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const stbi_uc* GetData() const { return (const stbi_uc*)m_Data; }
+        size_t GetSize() const { return m_Size; }
+    private:
+        void* m_Data = nullptr;
+        size_t m_Size = 0;
+#ifdef _WIN32
+        HANDLE m_File = INVALID_HANDLE_VALUE;
+        HANDLE m_Mapping = nullptr;
+#endif
+    };
+
+    struct DecodedImage
     {
-        int width, height, channels;
-        uint8_t* data = nullptr;
+        uint32_t width = 0, height = 0;
+        ImageFormat format = ImageFormat::None;
+        // Allocated by stb_image, null if decoding failed
+        void* pixels = nullptr;
+    };
 
-        if (stbi_is_hdr(m_Filepath.c_str()))
+    // Shown while an image is still loading, or instead of one that failed to load
+    static constexpr uint32_t s_PlaceholderPixel = 0xff808080;
+
+    // Safe to call from any thread, stb_image keeps no shared state apart from its flip settings
+    static DecodedImage DecodeImageFile(const std::string& path)
+    {
+        DecodedImage image;
+
+        MappedFile file(path);
+        if (!file.GetData() || file.GetSize() > (size_t)INT32_MAX)
         {
-            data = (uint8_t*)stbi_loadf(m_Filepath.c_str(), &width, &height, &channels, 4);
-            m_Format = ImageFormat::RGBA32F;
+            std::cerr << "[ERROR] Failed to open image " << path << "." << std::endl;
+            return image;
+        }
+
+        int width, height, channels;
+        auto size = (int)file.GetSize();
+        if (stbi_is_hdr_from_memory(file.GetData(), size))
+        {
+            image.pixels = stbi_loadf_from_memory(file.GetData(), size, &width, &height, &channels, 4);
+            image.format = ImageFormat::RGBA32F;
         }
         else
         {
-            data = stbi_load(m_Filepath.c_str(), &width, &height, &channels, 4);
-            m_Format = ImageFormat::RGBA;
+            image.pixels = stbi_load_from_memory(file.GetData(), size, &width, &height, &channels, 4);
+            image.format = ImageFormat::RGBA;
         }
 
-        m_Width = width;
-        m_Height = height;
+        if (!image.pixels)
+        {
+            std::cerr << "[ERROR] Failed to decode image " << path << ": " << stbi_failure_reason() << std::endl;
+            return {};
+        }
+
+        image.width = (uint32_t)width;
+        image.height = (uint32_t)height;
+        return image;
+    }
+
+    struct ImageLoadJob
+    {
+        std::weak_ptr<Image> image;
+        std::string path;
+    };
+
+    struct LoadedImage
+    {
+        std::weak_ptr<Image> image;
+        DecodedImage decoded;
+    };
+
+    // Everything uploaded by one BeginFrame, retired once its fence has signaled
+    struct ImageUploadBatch
+    {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        MemoryAllocation memory;
+        std::vector<std::weak_ptr<Image>> images;
+    };
+
+    // Caps the staging memory of one batch, decoded images that do not fit wait for the next frame
+    static constexpr VkDeviceSize s_MaxUploadBatchSize = 64ull * 1024 * 1024;
+
+    static std::vector<std::thread> s_LoaderThreads;
+    static std::mutex s_LoaderMutex;
+    static std::condition_variable s_LoaderCondition;
+    static std::deque<ImageLoadJob> s_LoadJobs;
+    static std::vector<LoadedImage> s_LoadedImages;
+    static bool s_LoaderStopping = false;
+    static std::vector<ImageUploadBatch> s_UploadBatches;
+
+    static void ImageLoaderLoop()
+    {
+        while (true)
+        {
+            ImageLoadJob job;
+            {
+                std::unique_lock<std::mutex> lock(s_LoaderMutex);
+                s_LoaderCondition.wait(lock, []() { return s_LoaderStopping || !s_LoadJobs.empty(); });
+                if (s_LoaderStopping)
+                    return;
+                job = std::move(s_LoadJobs.front());
+                s_LoadJobs.pop_front();
+            }
+
+            // Nobody is waiting for it anymore
+            if (job.image.expired())
+                continue;
+
+            DecodedImage decoded = DecodeImageFile(job.path);
+
+            std::lock_guard<std::mutex> lock(s_LoaderMutex);
+            s_LoadedImages.push_back({std::move(job.image), decoded});
+        }
+    }
+
+    std::shared_ptr<Image> LoadImageAsync(const std::string& path)
+    {
+        uint32_t placeholder = s_PlaceholderPixel;
+        auto image = std::make_shared<Image>(1, 1, ImageFormat::RGBA, &placeholder);
+        image->m_Filepath = path;
+        image->m_Ready = false;
+
+        std::lock_guard<std::mutex> lock(s_LoaderMutex);
+        if (s_LoaderThreads.empty())
+        {
+            // Leave room for the main thread and whatever else the application runs
+            uint32_t threadCount = std::max(std::thread::hardware_concurrency() / 2, 1u);
+            for (uint32_t i = 0; i < threadCount; i++)
+                s_LoaderThreads.emplace_back(ImageLoaderLoop);
+        }
+        s_LoadJobs.push_back({image, path});
+        s_LoaderCondition.notify_one();
+        return image;
+    }
+
+    static void DestroyUploadBatch(ImageUploadBatch& batch)
+    {
+        vkDestroyFence(s_Device, batch.fence, s_Allocator);
+        vkFreeCommandBuffers(s_Device, s_UploadCommandPool, 1, &batch.commandBuffer);
+        vkDestroyBuffer(s_Device, batch.buffer, s_Allocator);
+        FreeDeviceMemory(batch.memory);
+    }
+
+    static void StopImageLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(s_LoaderMutex);
+            s_LoaderStopping = true;
+        }
+        s_LoaderCondition.notify_all();
+        for (auto& thread : s_LoaderThreads)
+            thread.join();
+        s_LoaderThreads.clear();
+
+        for (LoadedImage& loaded : s_LoadedImages)
+            stbi_image_free(loaded.decoded.pixels);
+        s_LoadedImages.clear();
+        s_LoadJobs.clear();
+
+        // Only called once the device is idle
+        for (ImageUploadBatch& batch : s_UploadBatches)
+            DestroyUploadBatch(batch);
+        s_UploadBatches.clear();
+    }
+
+    void Image::UploadLoadedImages()
+    {
+        VkResult err;
+
+        // Retire finished batches first, their images are complete now
+        for (size_t i = 0; i < s_UploadBatches.size();)
+        {
+            ImageUploadBatch& batch = s_UploadBatches[i];
+            if (vkGetFenceStatus(s_Device, batch.fence) != VK_SUCCESS)
+            {
+                i++;
+                continue;
+            }
+
+            for (auto& weak_image : batch.images)
+            {
+                if (auto image = weak_image.lock())
+                    image->m_Ready = true;
+            }
+            DestroyUploadBatch(batch);
+            s_UploadBatches.erase(s_UploadBatches.begin() + (ptrdiff_t)i);
+        }
+
+        // Take as many decoded images as fit one batch, offsets keep every image 16 byte aligned for RGBA32F
+        std::vector<LoadedImage> loaded;
+        std::vector<VkDeviceSize> offsets;
+        VkDeviceSize batch_size = 0;
+        {
+            std::lock_guard<std::mutex> lock(s_LoaderMutex);
+            size_t count = 0;
+            for (; count < s_LoadedImages.size(); count++)
+            {
+                const DecodedImage& decoded = s_LoadedImages[count].decoded;
+                VkDeviceSize size = (VkDeviceSize)decoded.width * decoded.height * BytesPerPixel(decoded.format);
+                if (count > 0 && batch_size + size > s_MaxUploadBatchSize)
+                    break;
+                offsets.push_back(batch_size);
+                batch_size += (size + 15) & ~(VkDeviceSize)15;
+            }
+            loaded.assign(std::make_move_iterator(s_LoadedImages.begin()), std::make_move_iterator(s_LoadedImages.begin() + (ptrdiff_t)count));
+            s_LoadedImages.erase(s_LoadedImages.begin(), s_LoadedImages.begin() + (ptrdiff_t)count);
+        }
+        if (loaded.empty())
+            return;
+
+        // Failed decodes keep their placeholder, images that were dropped meanwhile are skipped
+        std::vector<std::shared_ptr<Image>> images(loaded.size());
+        bool any_upload = false;
+        for (size_t i = 0; i < loaded.size(); i++)
+        {
+            if (loaded[i].decoded.pixels)
+                images[i] = loaded[i].image.lock();
+            else if (auto image = loaded[i].image.lock())
+                image->m_Failed = true;
+            any_upload |= images[i] != nullptr;
+        }
+        if (!any_upload)
+        {
+            for (LoadedImage& image : loaded)
+                stbi_image_free(image.decoded.pixels);
+            return;
+        }
+
+        // One staging buffer, one command buffer and one submit for the whole batch
+        ImageUploadBatch batch;
+        {
+            VkBufferCreateInfo buffer_info = {};
+            buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            buffer_info.size = batch_size;
+            buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+            buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            err = vkCreateBuffer(s_Device, &buffer_info, s_Allocator, &batch.buffer);
+            check_vk_result(err);
+            VkMemoryRequirements req;
+            vkGetBufferMemoryRequirements(s_Device, batch.buffer, &req);
+            batch.memory = AllocateDeviceMemory(req, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, true);
+            err = vkBindBufferMemory(s_Device, batch.buffer, batch.memory.memory, batch.memory.offset);
+            check_vk_result(err);
+
+            for (size_t i = 0; i < loaded.size(); i++)
+            {
+                const DecodedImage& decoded = loaded[i].decoded;
+                if (images[i])
+                    memcpy(batch.memory.mapped + offsets[i], decoded.pixels, (size_t)decoded.width * decoded.height * BytesPerPixel(decoded.format));
+                stbi_image_free(decoded.pixels);
+            }
+
+            VkMappedMemoryRange range = {};
+            range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+            range.memory = batch.memory.memory;
+            range.offset = batch.memory.offset;
+            range.size = batch.memory.size;
+            err = vkFlushMappedMemoryRanges(s_Device, 1, &range);
+            check_vk_result(err);
+        }
+
+        {
+            VkCommandBufferAllocateInfo alloc_info = {};
+            alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            alloc_info.commandPool = s_UploadCommandPool;
+            alloc_info.commandBufferCount = 1;
+            err = vkAllocateCommandBuffers(s_Device, &alloc_info, &batch.commandBuffer);
+            check_vk_result(err);
+
+            VkCommandBufferBeginInfo begin_info = {};
+            begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            begin_info.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            err = vkBeginCommandBuffer(batch.commandBuffer, &begin_info);
+            check_vk_result(err);
+        }
+
+        for (size_t i = 0; i < loaded.size(); i++)
+        {
+            Image* image = images[i].get();
+            if (!image)
+                continue;
+
+            // Swap the placeholder for an image of the real size and format
+            const DecodedImage& decoded = loaded[i].decoded;
+            image->Release();
+            image->m_Width = decoded.width;
+            image->m_Height = decoded.height;
+            image->m_Format = decoded.format;
+            image->AllocateMemory(image->m_Width * image->m_Height * BytesPerPixel(image->m_Format));
+
+            VkBufferImageCopy copy = {};
+            copy.bufferOffset = offsets[i];
+            copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copy.imageSubresource.layerCount = 1;
+            copy.imageExtent.width = image->m_Width;
+            copy.imageExtent.height = image->m_Height;
+            copy.imageExtent.depth = 1;
+            image->RecordCopy(batch.commandBuffer, batch.buffer, {copy}, true);
+            batch.images.push_back(images[i]);
+        }
+
+        {
+            VkFenceCreateInfo fence_info = {};
+            fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            err = vkCreateFence(s_Device, &fence_info, s_Allocator, &batch.fence);
+            check_vk_result(err);
+
+            VkSubmitInfo end_info = {};
+            end_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            end_info.commandBufferCount = 1;
+            end_info.pCommandBuffers = &batch.commandBuffer;
+            err = vkEndCommandBuffer(batch.commandBuffer);
+            check_vk_result(err);
+            err = vkQueueSubmit(s_Queue, 1, &end_info, batch.fence);
+            check_vk_result(err);
+        }
+
+        s_UploadBatches.push_back(std::move(batch));
+    }
+
+    Image::Image(const std::string& path)
+            : m_Filepath(path)
+    {
+        DecodedImage decoded = DecodeImageFile(m_Filepath);
+        uint32_t placeholder = s_PlaceholderPixel;
+        if (!decoded.pixels)
+        {
+            decoded = {1, 1, ImageFormat::RGBA, &placeholder};
+            m_Ready = false;
+            m_Failed = true;
+        }
+
+        m_Width = decoded.width;
+        m_Height = decoded.height;
+        m_Format = decoded.format;
 
         AllocateMemory(m_Width * m_Height * BytesPerPixel(m_Format));
-        SetData(data);
+        SetData(decoded.pixels);
+
+        if (decoded.pixels != &placeholder)
+            stbi_image_free(decoded.pixels);
     }
 
     Image::Image(uint32_t width, uint32_t height, ImageFormat format, const void* data)
@@ -667,15 +1504,11 @@ namespace SauronLT {
             info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
             err = vkCreateImage(device, &info, nullptr, &m_Image);
             check_vk_result(err);
+            m_Layout = VK_IMAGE_LAYOUT_UNDEFINED;
             VkMemoryRequirements req;
             vkGetImageMemoryRequirements(device, m_Image, &req);
-            VkMemoryAllocateInfo alloc_info = {};
-            alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            alloc_info.allocationSize = req.size;
-            alloc_info.memoryTypeIndex = GetVulkanMemoryType(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, req.memoryTypeBits);
-            err = vkAllocateMemory(device, &alloc_info, nullptr, &m_Memory);
-            check_vk_result(err);
-            err = vkBindImageMemory(device, m_Image, m_Memory, 0);
+            m_Memory = AllocateDeviceMemory(req, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+            err = vkBindImageMemory(device, m_Image, m_Memory.memory, m_Memory.offset);
             check_vk_result(err);
         }
 
@@ -716,97 +1549,203 @@ namespace SauronLT {
 
     void Image::Release()
     {
+        std::vector<VkCommandBuffer> commandBuffers;
+        std::vector<VkFence> fences;
+        // Only submitted fences ever signal, waiting on one of a slot that was never used would never return
+        std::vector<VkFence> pendingFences;
+        for (auto& slot : m_UploadSlots)
+        {
+            commandBuffers.push_back(slot.commandBuffer);
+            fences.push_back(slot.fence);
+            if (slot.pending)
+                pendingFences.push_back(slot.fence);
+        }
+
         // TODO fix validation errors
         s_ResourceFreeQueue[s_MainWindowData.FrameIndex].emplace_back(
                 ([sampler = m_Sampler, imageView = m_ImageView, image = m_Image,
-                memory = m_Memory, stagingBuffer = m_StagingBuffer, stagingBufferMemory = m_StagingBufferMemory]()
+                memory = m_Memory, stagingBuffer = m_StagingBuffer, stagingMemory = m_StagingMemory,
+                commandBuffers, fences, pendingFences]()
         {
+            // Uploads are only tracked by their fences, make sure none is still reading the staging ring
+            if (!pendingFences.empty())
+                vkWaitForFences(s_Device, (uint32_t)pendingFences.size(), pendingFences.data(), VK_TRUE, UINT64_MAX);
+            for (VkFence fence : fences)
+                vkDestroyFence(s_Device, fence, nullptr);
+            if (!commandBuffers.empty())
+                vkFreeCommandBuffers(s_Device, s_UploadCommandPool, (uint32_t)commandBuffers.size(), commandBuffers.data());
+
             vkDestroySampler(s_Device, sampler, nullptr);
             vkDestroyImageView(s_Device, imageView, nullptr);
             vkDestroyImage(s_Device, image, nullptr);
-            vkFreeMemory(s_Device, memory, nullptr);
+            FreeDeviceMemory(memory);
             vkDestroyBuffer(s_Device, stagingBuffer, nullptr);
-            vkFreeMemory(s_Device, stagingBufferMemory, nullptr);
+            FreeDeviceMemory(stagingMemory);
         }
         ));
 
 //        vkDestroySampler(s_Device, m_Sampler, nullptr);
 //        vkDestroyImageView(s_Device, m_ImageView, nullptr);
 //        vkDestroyImage(s_Device, m_Image, nullptr);
-//        vkFreeMemory(s_Device, m_Memory, nullptr);
+//        FreeDeviceMemory(m_Memory);
 //        vkDestroyBuffer(s_Device, m_StagingBuffer, nullptr);
-//        vkFreeMemory(s_Device, m_StagingBufferMemory, nullptr);
+//        FreeDeviceMemory(m_StagingMemory);
 //        ImGui_ImplVulkan_RemoveTexture(m_DescriptorSet);
 
         m_Sampler = nullptr;
         m_ImageView = nullptr;
         m_Image = nullptr;
-        m_Memory = nullptr;
+        m_Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        m_Memory = {};
         m_StagingBuffer = nullptr;
-        m_StagingBufferMemory = nullptr;
+        m_StagingMemory = {};
+        m_UploadSlots.clear();
+        m_UploadIndex = 0;
     }
 
-    void Image::SetData(const void* data)
+    void Image::AllocateStagingRing()
     {
+        VkResult err;
+
+        // Slots start on offsets that are valid for both flushing and copying
         size_t upload_size = m_Width * m_Height * BytesPerPixel(m_Format);
+        VkDeviceSize alignment = std::max<VkDeviceSize>(s_NonCoherentAtomSize, 256);
+        m_AlignedSize = (upload_size + alignment - 1) / alignment * alignment;
+        auto slot_count = (uint32_t)std::max(s_MainWindowData.ImageCount, 2u);
 
-        VkResult err;
+        // Create the Upload Buffer
+        {
+            VkBufferCreateInfo buffer_info = {};
+            buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            buffer_info.size = m_AlignedSize * slot_count;
+            buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+            buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            err = vkCreateBuffer(s_Device, &buffer_info, nullptr, &m_StagingBuffer);
+            check_vk_result(err);
+            VkMemoryRequirements req;
+            vkGetBufferMemoryRequirements(s_Device, m_StagingBuffer, &req);
 
-        if (!m_StagingBuffer)
+            // Host visible blocks stay mapped, the allocation already points into them
+            m_StagingMemory = AllocateDeviceMemory(req, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, true);
+            err = vkBindBufferMemory(s_Device, m_StagingBuffer, m_StagingMemory.memory, m_StagingMemory.offset);
+            check_vk_result(err);
+        }
+
+        // Command buffers and fences, one pair per slot
         {
-            // Create the Upload Buffer
+            std::vector<VkCommandBuffer> command_buffers(slot_count);
+            VkCommandBufferAllocateInfo alloc_info = {};
+            alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            alloc_info.commandPool = s_UploadCommandPool;
+            alloc_info.commandBufferCount = slot_count;
+            err = vkAllocateCommandBuffers(s_Device, &alloc_info, command_buffers.data());
+            check_vk_result(err);
+
+            m_UploadSlots.resize(slot_count);
+            for (uint32_t i = 0; i < slot_count; i++)
             {
-                VkBufferCreateInfo buffer_info = {};
-                buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-                buffer_info.size = upload_size;
-                buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-                buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-                err = vkCreateBuffer(s_Device, &buffer_info, nullptr, &m_StagingBuffer);
-                check_vk_result(err);
-                VkMemoryRequirements req;
-                vkGetBufferMemoryRequirements(s_Device, m_StagingBuffer, &req);
-                m_AlignedSize = req.size;
-                VkMemoryAllocateInfo alloc_info = {};
-                alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-                alloc_info.allocationSize = req.size;
-                alloc_info.memoryTypeIndex = GetVulkanMemoryType(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, req.memoryTypeBits);
-                err = vkAllocateMemory(s_Device, &alloc_info, nullptr, &m_StagingBufferMemory);
-                check_vk_result(err);
-                err = vkBindBufferMemory(s_Device, m_StagingBuffer, m_StagingBufferMemory, 0);
+                m_UploadSlots[i].commandBuffer = command_buffers[i];
+
+                VkFenceCreateInfo fence_info = {};
+                fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+                err = vkCreateFence(s_Device, &fence_info, nullptr, &m_UploadSlots[i].fence);
                 check_vk_result(err);
             }
         }
 
-        // Upload to Buffer
+        m_UploadIndex = 0;
+    }
+
+    void Image::SetData(const void* data)
+    {
+        size_t upload_size = m_Width * m_Height * BytesPerPixel(m_Format);
+        memcpy(BeginWrite(), data, upload_size);
+        EndWrite();
+    }
+
+    void Image::SetData(const void* data, const std::vector<ImageRegion>& regions)
+    {
+        // Only the dirty rows end up in the staging slot, the rest of it is never read
+        uint32_t bytes_per_pixel = BytesPerPixel(m_Format);
+        auto staging = (char*)BeginWrite();
+        for (const ImageRegion& region : ClipRegions(regions))
         {
-            char* map = NULL;
-            err = vkMapMemory(s_Device, m_StagingBufferMemory, 0, m_AlignedSize, 0, (void**)(&map));
-            check_vk_result(err);
-            memcpy(map, data, upload_size);
-            VkMappedMemoryRange range[1] = {};
-            range[0].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-            range[0].memory = m_StagingBufferMemory;
-            range[0].size = m_AlignedSize;
-            err = vkFlushMappedMemoryRanges(s_Device, 1, range);
+            for (uint32_t y = region.y; y < region.y + region.height; y++)
+            {
+                size_t offset = ((size_t)y * m_Width + region.x) * bytes_per_pixel;
+                memcpy(staging + offset, (const char*)data + offset, (size_t)region.width * bytes_per_pixel);
+            }
+        }
+        EndWrite(regions);
+    }
+
+    void* Image::BeginWrite()
+    {
+        VkResult err;
+
+        if (!m_StagingBuffer)
+            AllocateStagingRing();
+
+        // Only waits if this slot's upload from ImageCount frames ago is still in flight.
+        // The fence is reset by the submit in EndWrite, a write that uploads nothing leaves it as it is.
+        m_WriteIndex = m_UploadIndex;
+        m_UploadIndex = (m_UploadIndex + 1) % (uint32_t)m_UploadSlots.size();
+        UploadSlot& slot = m_UploadSlots[m_WriteIndex];
+        if (slot.pending)
+        {
+            err = vkWaitForFences(s_Device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
             check_vk_result(err);
-            vkUnmapMemory(s_Device, m_StagingBufferMemory);
+            slot.pending = false;
         }
 
+        return m_StagingMemory.mapped + m_WriteIndex * m_AlignedSize;
+    }
 
-        // Copy to Image
+    void Image::EndWrite()
+    {
+        EndWrite({{0, 0, m_Width, m_Height}});
+    }
+
+    void Image::EndWrite(const std::vector<ImageRegion>& regions)
+    {
+        VkResult err;
+
+        UploadSlot& slot = m_UploadSlots[m_WriteIndex];
+        VkDeviceSize slot_offset = m_WriteIndex * m_AlignedSize;
+        uint32_t bytes_per_pixel = BytesPerPixel(m_Format);
+
+        std::vector<ImageRegion> clipped = ClipRegions(regions);
+        if (clipped.empty())
+            return;
+
+        bool full_upload = clipped.size() == 1 && clipped[0].width == m_Width && clipped[0].height == m_Height;
+
+        // Upload to Buffer, one flush per region covering its rows
         {
-            VkCommandPool command_pool = s_MainWindowData.Frames[s_MainWindowData.FrameIndex].CommandPool;
-            VkCommandBuffer command_buffer;
+            std::vector<VkMappedMemoryRange> ranges(clipped.size());
+            for (size_t i = 0; i < clipped.size(); i++)
             {
-                VkCommandBufferAllocateInfo alloc_info{};
-                alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-                alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-                alloc_info.commandPool = command_pool;
-                alloc_info.commandBufferCount = 1;
+                const ImageRegion& region = clipped[i];
+                VkDeviceSize first = ((VkDeviceSize)region.y * m_Width + region.x) * bytes_per_pixel;
+                VkDeviceSize last = ((VkDeviceSize)(region.y + region.height - 1) * m_Width + region.x + region.width) * bytes_per_pixel;
+                first = first / s_NonCoherentAtomSize * s_NonCoherentAtomSize;
+                last = std::min<VkDeviceSize>((last + s_NonCoherentAtomSize - 1) / s_NonCoherentAtomSize * s_NonCoherentAtomSize, m_AlignedSize);
+
+                ranges[i].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+                ranges[i].memory = m_StagingMemory.memory;
+                ranges[i].offset = m_StagingMemory.offset + slot_offset + first;
+                ranges[i].size = last - first;
+            }
+            err = vkFlushMappedMemoryRanges(s_Device, (uint32_t)ranges.size(), ranges.data());
+            check_vk_result(err);
+        }
 
-                err = vkAllocateCommandBuffers(s_Device, &alloc_info, &command_buffer);
-                check_vk_result(err);
 
+        // Copy to Image
+        {
+            VkCommandBuffer command_buffer = slot.commandBuffer;
+            {
                 VkCommandBufferBeginInfo begin_info = {};
                 begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
                 begin_info.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
@@ -814,43 +1753,25 @@ namespace SauronLT {
                 check_vk_result(err);
             }
 
-            VkImageMemoryBarrier copy_barrier = {};
-            copy_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            copy_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            copy_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            copy_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            copy_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            copy_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            copy_barrier.image = m_Image;
-            copy_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            copy_barrier.subresourceRange.levelCount = 1;
-            copy_barrier.subresourceRange.layerCount = 1;
-            vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &copy_barrier);
-
-            VkBufferImageCopy region = {};
-            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            region.imageSubresource.layerCount = 1;
-            region.imageExtent.width = m_Width;
-            region.imageExtent.height = m_Height;
-            region.imageExtent.depth = 1;
-            vkCmdCopyBufferToImage(command_buffer, m_StagingBuffer, m_Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-            VkImageMemoryBarrier use_barrier = {};
-            use_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            use_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            use_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-            use_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            use_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            use_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            use_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            use_barrier.image = m_Image;
-            use_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            use_barrier.subresourceRange.levelCount = 1;
-            use_barrier.subresourceRange.layerCount = 1;
-            vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-                                 0, nullptr, 0, nullptr, 1, &use_barrier);
-
-            // End command buffer
+            // The slot has the same layout as the image, so every region reads from its own spot
+            std::vector<VkBufferImageCopy> copies(clipped.size());
+            for (size_t i = 0; i < clipped.size(); i++)
+            {
+                const ImageRegion& region = clipped[i];
+                VkBufferImageCopy& copy = copies[i];
+                copy.bufferOffset = slot_offset + ((VkDeviceSize)region.y * m_Width + region.x) * bytes_per_pixel;
+                copy.bufferRowLength = m_Width;
+                copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                copy.imageSubresource.layerCount = 1;
+                copy.imageOffset.x = (int32_t)region.x;
+                copy.imageOffset.y = (int32_t)region.y;
+                copy.imageExtent.width = region.width;
+                copy.imageExtent.height = region.height;
+                copy.imageExtent.depth = 1;
+            }
+            RecordCopy(command_buffer, m_StagingBuffer, copies, full_upload);
+
+            // End command buffer, the fence tells when this slot may be written again
             {
                 VkSubmitInfo end_info = {};
                 end_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -858,14 +1779,72 @@ namespace SauronLT {
                 end_info.pCommandBuffers = &command_buffer;
                 err = vkEndCommandBuffer(command_buffer);
                 check_vk_result(err);
-                err = vkQueueSubmit(s_Queue, 1, &end_info, VK_NULL_HANDLE);
+                err = vkResetFences(s_Device, 1, &slot.fence);
                 check_vk_result(err);
-                err = vkDeviceWaitIdle(s_Device);
+                err = vkQueueSubmit(s_Queue, 1, &end_info, slot.fence);
                 check_vk_result(err);
+                slot.pending = true;
             }
         }
     }
 
+    void Image::RecordCopy(VkCommandBuffer command_buffer, VkBuffer buffer, const std::vector<VkBufferImageCopy>& copies, bool discard)
+    {
+        // Frames still in flight may be sampling the image, the queue orders the copy after them.
+        // Overwriting everything may discard the old contents, otherwise they have to be kept.
+        VkImageLayout old_layout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : m_Layout;
+
+        VkImageMemoryBarrier copy_barrier = {};
+        copy_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        copy_barrier.srcAccessMask = old_layout == VK_IMAGE_LAYOUT_UNDEFINED ? 0 : VK_ACCESS_SHADER_READ_BIT;
+        copy_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        copy_barrier.oldLayout = old_layout;
+        copy_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        copy_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        copy_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        copy_barrier.image = m_Image;
+        copy_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copy_barrier.subresourceRange.levelCount = 1;
+        copy_barrier.subresourceRange.layerCount = 1;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &copy_barrier);
+
+        vkCmdCopyBufferToImage(command_buffer, buffer, m_Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)copies.size(), copies.data());
+
+        VkImageMemoryBarrier use_barrier = {};
+        use_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        use_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        use_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        use_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        use_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        use_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        use_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        use_barrier.image = m_Image;
+        use_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        use_barrier.subresourceRange.levelCount = 1;
+        use_barrier.subresourceRange.layerCount = 1;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &use_barrier);
+        m_Layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+
+    std::vector<ImageRegion> Image::ClipRegions(const std::vector<ImageRegion>& regions) const
+    {
+        std::vector<ImageRegion> clipped;
+        clipped.reserve(regions.size());
+        for (const ImageRegion& region : regions)
+        {
+            if (region.x >= m_Width || region.y >= m_Height)
+                continue;
+
+            ImageRegion result = region;
+            result.width = std::min(region.width, m_Width - region.x);
+            result.height = std::min(region.height, m_Height - region.y);
+            if (result.width > 0 && result.height > 0)
+                clipped.push_back(result);
+        }
+        return clipped;
+    }
+
     void Image::Resize(uint32_t width, uint32_t height)
     {
         if (m_Image && m_Width == width && m_Height == height)
@@ -877,4 +1856,20 @@ namespace SauronLT {
         Release();
         AllocateMemory(m_Width * m_Height * BytesPerPixel(m_Format));
     }
+
+    bool Image::Reserve(uint32_t width, uint32_t height)
+    {
+        if (width <= m_Width && height <= m_Height)
+            return false;
+
+        // Grow by a quarter at least, so a viewport that grows a few pixels per frame does not reallocate every time
+        auto grow = [](uint32_t current, uint32_t required)
+        {
+            if (required <= current)
+                return current;
+            return (std::max(required, current + current / 4) + 63) & ~63u;
+        };
+        Resize(grow(m_Width, width), grow(m_Height, height));
+        return true;
+    }
 }
\ No newline at end of file
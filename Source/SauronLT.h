@@ -11,6 +11,9 @@
 #include "Input.h"
 
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
 #ifndef NDEBUG
 #define IMGUI_VULKAN_DEBUG_REPORT
@@ -31,6 +34,24 @@ namespace SauronLT {
         RGBA32F
     };
 
+    // Sub-range of one of the device memory blocks SauronLT allocates from
+    struct MemoryAllocation
+    {
+        VkDeviceMemory memory = nullptr;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        // Set for host visible memory, already offset into the block
+        char* mapped = nullptr;
+        uint32_t block = 0;
+    };
+
+    // Pixel rectangle of an image, used for partial uploads
+    struct ImageRegion
+    {
+        uint32_t x = 0, y = 0;
+        uint32_t width = 0, height = 0;
+    };
+
     class Image
     {
     public:
@@ -39,37 +60,115 @@ namespace SauronLT {
         ~Image();
 
         void SetData(const void* data);
+        // data still holds the whole image, only the given regions are copied and uploaded
+        void SetData(const void* data, const std::vector<ImageRegion>& regions);
+
+        // Zero-copy alternative to SetData: fill the returned mapped staging memory
+        // (width * height pixels, tightly packed) and hand it to the GPU with EndWrite.
+        // Passing regions uploads only those, the rest of the image keeps its contents.
+        void* BeginWrite();
+        void EndWrite();
+        void EndWrite(const std::vector<ImageRegion>& regions);
 
         VkDescriptorSet GetDescriptorSet() const { return m_DescriptorSet; }
 
         void Resize(uint32_t width, uint32_t height);
+        // Grows the image if it is smaller than width x height in either direction, keeps it otherwise.
+        // Returns true if it was recreated, which discards its contents.
+        bool Reserve(uint32_t width, uint32_t height);
 
         uint32_t GetWidth() const { return m_Width; }
         uint32_t GetHeight() const { return m_Height; }
+        // False while an image from LoadImageAsync still shows its placeholder, and after it failed to load
+        bool IsReady() const { return m_Ready; }
+        // The file could not be read or decoded, the placeholder stays
+        bool HasFailed() const { return m_Failed; }
         // Either release manually, or release by destruction
         void Release();
     private:
         void AllocateMemory(uint64_t size);
+        void AllocateStagingRing();
+        std::vector<ImageRegion> ClipRegions(const std::vector<ImageRegion>& regions) const;
+        // Records the layout transitions around copies from buffer, leaves the image ready for sampling
+        void RecordCopy(VkCommandBuffer command_buffer, VkBuffer buffer, const std::vector<VkBufferImageCopy>& copies, bool discard);
+
+        // Called by BeginFrame, uploads what the loader threads have decoded in one batch
+        static void UploadLoadedImages();
+        friend void BeginFrame();
+        friend std::shared_ptr<Image> LoadImageAsync(const std::string& path);
+    private:
+        // One per frame in flight, recorded once per upload and reused
+        struct UploadSlot
+        {
+            VkCommandBuffer commandBuffer = nullptr;
+            VkFence fence = nullptr;
+            bool pending = false;
+        };
     private:
         uint32_t m_Width = 0, m_Height = 0;
 
         VkImage m_Image = nullptr;
+        // As of the last recorded upload
+        VkImageLayout m_Layout = VK_IMAGE_LAYOUT_UNDEFINED;
         VkImageView m_ImageView = nullptr;
-        VkDeviceMemory m_Memory = nullptr;
+        MemoryAllocation m_Memory;
         VkSampler m_Sampler = nullptr;
 
         ImageFormat m_Format = ImageFormat::None;
 
+        // Ring of upload slots, persistently mapped
         VkBuffer m_StagingBuffer = nullptr;
-        VkDeviceMemory m_StagingBufferMemory = nullptr;
+        MemoryAllocation m_StagingMemory;
+        std::vector<UploadSlot> m_UploadSlots;
+        uint32_t m_UploadIndex = 0;
+        uint32_t m_WriteIndex = 0;
 
+        // Size of one staging slot
         size_t m_AlignedSize = 0;
 
         VkDescriptorSet m_DescriptorSet = nullptr;
 
         std::string m_Filepath;
+        bool m_Ready = true;
+        bool m_Failed = false;
+    };
+
+    // Decodes the file on background threads and returns right away. Until a later BeginFrame has
+    // uploaded the pixels the image is a 1x1 placeholder, see Image::IsReady and Image::HasFailed. Files are memory mapped.
+    std::shared_ptr<Image> LoadImageAsync(const std::string& path);
+
+    enum class PresentMode
+    {
+        // Vsync, every frame gets shown, input waits behind the whole swapchain
+        Fifo,
+        // Vsync, a newer frame replaces the queued one, falls back to Fifo
+        Mailbox,
+        // No vsync, may tear, falls back to Mailbox and then Fifo
+        Immediate
     };
 
+    // The swapchain follows at the start of the next frame
+    void SetPresentMode(PresentMode mode);
+    // Requested
+    PresentMode GetPresentMode();
+    // In use, after the fallbacks for what the surface supports
+    PresentMode GetActivePresentMode();
+    const char* GetPresentModeName(PresentMode mode);
+    // Requested minimum, the surface can make it larger
+    void SetSwapchainImageCount(uint32_t count);
+    uint32_t GetSwapchainImageCount();
+    // Sleeps in BeginFrame, before input is polled, to cap the frame rate; 0 does not limit
+    void SetFrameLimit(float framesPerSecond);
+    float GetFrameLimit();
+    // glfwGetTime right after BeginFrame polled input
+    double GetInputTime();
+    // What the current frame shows reflects the input polled at time, the GetInputTime of this or an earlier frame.
+    // Content rendered on another thread lags behind the UI, call between BeginFrame and EndFrame.
+    void SetFrameInputTime(double time);
+    // Average ms from polling the input a frame reflects until the presentation engine gave the frame's image back.
+    // An image comes back once a newer frame replaced it on screen, so this overestimates input to photon by up to a refresh.
+    float GetInputLatency();
+
     void Init(int windowWidth, int windowHeight, const char* appName);
     void Shutdown();
     bool Running();
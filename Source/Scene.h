@@ -0,0 +1,36 @@
+#ifndef RTX_SCENE_H
+#define RTX_SCENE_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+struct Material {
+    glm::vec3 albedo;
+    float roughness;
+    float metallic;
+};
+
+struct Sphere {
+    int materialIndex;
+    glm::vec3 position{0.0f};
+    float radius = 0.5f;
+};
+
+struct Scene {
+    std::vector<Sphere> spheres;
+    std::vector<Material> materials;
+};
+
+struct HitPayload {
+    glm::vec3 position;
+    glm::vec3 normal;
+    Sphere hitSphere;
+    float distance;
+};
+
+#endif //RTX_SCENE_H
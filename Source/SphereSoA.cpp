@@ -0,0 +1,192 @@
+#include "SphereSoA.h"
+#include <cfloat>
+
+#if RTX_SIMD_WIDTH > 1
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static uint32_t FirstSetBit(uint32_t mask)
+{
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (uint32_t)index;
+}
+#else
+static uint32_t FirstSetBit(uint32_t mask)
+{
+    return (uint32_t)__builtin_ctz(mask);
+}
+#endif
+
+void SphereSoA::Sync(const std::vector<Sphere>& spheres, const std::vector<uint32_t>& order)
+{
+    auto count = (uint32_t)order.size();
+
+    m_X.assign(count + Width, 0.0f);
+    m_Y.assign(count + Width, 0.0f);
+    m_Z.assign(count + Width, 0.0f);
+    m_RadiusSquared.assign(count + Width, 0.0f);
+    m_MaterialIndex.resize(count);
+    m_SphereIndex.resize(count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const Sphere& sphere = spheres[order[i]];
+        m_X[i] = sphere.position.x;
+        m_Y[i] = sphere.position.y;
+        m_Z[i] = sphere.position.z;
+        m_RadiusSquared[i] = sphere.radius * sphere.radius;
+        m_MaterialIndex[i] = sphere.materialIndex;
+        m_SphereIndex[i] = order[i];
+    }
+}
+
+// All paths evaluate the same expressions in the same order as the scalar loop,
+// so the result does not depend on the vector width.
+#if RTX_SIMD_WIDTH == 8
+
+bool SphereSoA::Intersect(const Ray& ray, float a, uint32_t first, uint32_t count, float& closestT, uint32_t& slot) const
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 fourA = _mm256_set1_ps(4.0f * a);
+    const __m256 twoA = _mm256_set1_ps(2.0f * a);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 infinity = _mm256_set1_ps(FLT_MAX);
+    const __m256 laneOffsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+    const __m256 originX = _mm256_set1_ps(ray.origin.x);
+    const __m256 originY = _mm256_set1_ps(ray.origin.y);
+    const __m256 originZ = _mm256_set1_ps(ray.origin.z);
+    const __m256 directionX = _mm256_set1_ps(ray.direction.x);
+    const __m256 directionY = _mm256_set1_ps(ray.direction.y);
+    const __m256 directionZ = _mm256_set1_ps(ray.direction.z);
+
+    uint32_t end = first + count;
+    const __m256 endLane = _mm256_set1_ps((float)end);
+    bool hasHit = false;
+
+    for (uint32_t base = first; base < end; base += 8)
+    {
+        __m256 ocX = _mm256_sub_ps(originX, _mm256_loadu_ps(&m_X[base]));
+        __m256 ocY = _mm256_sub_ps(originY, _mm256_loadu_ps(&m_Y[base]));
+        __m256 ocZ = _mm256_sub_ps(originZ, _mm256_loadu_ps(&m_Z[base]));
+
+        __m256 ocDotD = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocX, directionX), _mm256_mul_ps(ocY, directionY)), _mm256_mul_ps(ocZ, directionZ));
+        __m256 ocDotOc = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocX, ocX), _mm256_mul_ps(ocY, ocY)), _mm256_mul_ps(ocZ, ocZ));
+
+        __m256 b = _mm256_mul_ps(two, ocDotD);
+        __m256 c = _mm256_sub_ps(ocDotOc, _mm256_loadu_ps(&m_RadiusSquared[base]));
+        __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(fourA, c));
+        __m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_xor_ps(b, signMask), _mm256_sqrt_ps(discriminant)), twoA);
+
+        __m256 valid = _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ);
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(closestT), _CMP_LT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(_mm256_set1_ps((float)base), laneOffsets), endLane, _CMP_LT_OQ));
+        if (_mm256_movemask_ps(valid) == 0)
+            continue;
+
+        t = _mm256_blendv_ps(infinity, t, valid);
+        __m256 minimum = _mm256_min_ps(t, _mm256_permute2f128_ps(t, t, 0x01));
+        minimum = _mm256_min_ps(minimum, _mm256_shuffle_ps(minimum, minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+        minimum = _mm256_min_ps(minimum, _mm256_shuffle_ps(minimum, minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+        auto lanes = (uint32_t)_mm256_movemask_ps(_mm256_and_ps(valid, _mm256_cmp_ps(t, minimum, _CMP_EQ_OQ)));
+        closestT = _mm256_cvtss_f32(minimum);
+        slot = base + FirstSetBit(lanes);
+        hasHit = true;
+    }
+
+    return hasHit;
+}
+
+#elif RTX_SIMD_WIDTH == 4
+
+bool SphereSoA::Intersect(const Ray& ray, float a, uint32_t first, uint32_t count, float& closestT, uint32_t& slot) const
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 fourA = _mm_set1_ps(4.0f * a);
+    const __m128 twoA = _mm_set1_ps(2.0f * a);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 infinity = _mm_set1_ps(FLT_MAX);
+    const __m128i laneOffsets = _mm_setr_epi32(0, 1, 2, 3);
+
+    const __m128 originX = _mm_set1_ps(ray.origin.x);
+    const __m128 originY = _mm_set1_ps(ray.origin.y);
+    const __m128 originZ = _mm_set1_ps(ray.origin.z);
+    const __m128 directionX = _mm_set1_ps(ray.direction.x);
+    const __m128 directionY = _mm_set1_ps(ray.direction.y);
+    const __m128 directionZ = _mm_set1_ps(ray.direction.z);
+
+    uint32_t end = first + count;
+    const __m128i endLane = _mm_set1_epi32((int)end);
+    bool hasHit = false;
+
+    for (uint32_t base = first; base < end; base += 4)
+    {
+        __m128 ocX = _mm_sub_ps(originX, _mm_loadu_ps(&m_X[base]));
+        __m128 ocY = _mm_sub_ps(originY, _mm_loadu_ps(&m_Y[base]));
+        __m128 ocZ = _mm_sub_ps(originZ, _mm_loadu_ps(&m_Z[base]));
+
+        __m128 ocDotD = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocX, directionX), _mm_mul_ps(ocY, directionY)), _mm_mul_ps(ocZ, directionZ));
+        __m128 ocDotOc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocX, ocX), _mm_mul_ps(ocY, ocY)), _mm_mul_ps(ocZ, ocZ));
+
+        __m128 b = _mm_mul_ps(two, ocDotD);
+        __m128 c = _mm_sub_ps(ocDotOc, _mm_loadu_ps(&m_RadiusSquared[base]));
+        __m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(fourA, c));
+        __m128 t = _mm_div_ps(_mm_sub_ps(_mm_xor_ps(b, signMask), _mm_sqrt_ps(discriminant)), twoA);
+
+        __m128 valid = _mm_cmpge_ps(discriminant, zero);
+        valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, zero));
+        valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(closestT)));
+        valid = _mm_and_ps(valid, _mm_castsi128_ps(_mm_cmplt_epi32(_mm_add_epi32(_mm_set1_epi32((int)base), laneOffsets), endLane)));
+        if (_mm_movemask_ps(valid) == 0)
+            continue;
+
+        t = _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, infinity));
+        __m128 minimum = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+        minimum = _mm_min_ps(minimum, _mm_shuffle_ps(minimum, minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+        auto lanes = (uint32_t)_mm_movemask_ps(_mm_and_ps(valid, _mm_cmpeq_ps(t, minimum)));
+        closestT = _mm_cvtss_f32(minimum);
+        slot = base + FirstSetBit(lanes);
+        hasHit = true;
+    }
+
+    return hasHit;
+}
+
+#else
+
+bool SphereSoA::Intersect(const Ray& ray, float a, uint32_t first, uint32_t count, float& closestT, uint32_t& slot) const
+{
+    bool hasHit = false;
+
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        glm::vec3 origin = ray.origin - glm::vec3(m_X[i], m_Y[i], m_Z[i]);
+
+        float b = 2.0f * glm::dot(origin, ray.direction);
+        float c = glm::dot(origin, origin) - m_RadiusSquared[i];
+
+        float discriminant = b * b - 4.0f * a * c;
+        if (discriminant < 0.0f)
+            continue;
+
+        float t = (-b - glm::sqrt(discriminant)) / (2.0f * a);
+        if (t > 0.0f && t < closestT)
+        {
+            closestT = t;
+            slot = i;
+            hasHit = true;
+        }
+    }
+
+    return hasHit;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef RTX_SPHERESOA_H
+#define RTX_SPHERESOA_H
+
+#include "Scene.h"
+#include "AlignedAllocator.h"
+#include <vector>
+
+#if defined(__AVX__)
+#define RTX_SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RTX_SIMD_WIDTH 4
+#else
+#define RTX_SIMD_WIDTH 1
+#endif
+
+// Packed structure-of-arrays copy of Scene::spheres, in whatever order the owner needs
+// (the BVH stores it in leaf order). Radius is kept squared since that is all the test needs.
+class SphereSoA
+{
+public:
+    static constexpr uint32_t Width = RTX_SIMD_WIDTH;
+public:
+    // Rebuilds the mirror; slot i holds spheres[order[i]]
+    void Sync(const std::vector<Sphere>& spheres, const std::vector<uint32_t>& order);
+
+    // Nearest hit in slots [first, first + count) closer than closestT, tested Width spheres at a time.
+    // a is dot(ray.direction, ray.direction), hoisted out since it is the same for every sphere.
+    bool Intersect(const Ray& ray, float a, uint32_t first, uint32_t count, float& closestT, uint32_t& slot) const;
+
+    uint32_t GetSphereIndex(uint32_t slot) const { return m_SphereIndex[slot]; }
+    int GetMaterialIndex(uint32_t slot) const { return m_MaterialIndex[slot]; }
+    glm::vec3 GetPosition(uint32_t slot) const { return {m_X[slot], m_Y[slot], m_Z[slot]}; }
+    uint32_t GetCount() const { return (uint32_t)m_SphereIndex.size(); }
+private:
+    using FloatArray = std::vector<float, AlignedAllocator<float, 32>>;
+
+    // Padded by Width entries so a full vector load never reads past the end
+    FloatArray m_X, m_Y, m_Z, m_RadiusSquared;
+    std::vector<int> m_MaterialIndex;
+    std::vector<uint32_t> m_SphereIndex;
+};
+
+#endif //RTX_SPHERESOA_H
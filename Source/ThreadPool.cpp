@@ -0,0 +1,163 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+static thread_local uint32_t s_ThreadIndex = 0;
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+    Start(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+    Stop();
+}
+
+void ThreadPool::Resize(uint32_t threadCount)
+{
+    if (threadCount == 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    if (threadCount == GetThreadCount())
+        return;
+
+    Stop();
+    Start(threadCount);
+}
+
+uint32_t ThreadPool::GetThreadIndex()
+{
+    return s_ThreadIndex;
+}
+
+void ThreadPool::Start(uint32_t threadCount)
+{
+    if (threadCount == 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    m_Stopping = false;
+    m_Queues.clear();
+    for (uint32_t i = 0; i < threadCount; i++)
+        m_Queues.push_back(std::make_unique<WorkQueue>());
+
+    // Queue 0 belongs to the thread calling ParallelFor
+    for (uint32_t i = 1; i < threadCount; i++)
+        m_Threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+void ThreadPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stopping = true;
+    }
+    m_WakeCondition.notify_all();
+
+    for (auto& thread : m_Threads)
+        thread.join();
+    m_Threads.clear();
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const Job& job)
+{
+    if (count == 0)
+        return;
+
+    if (m_Queues.size() == 1)
+    {
+        for (uint32_t i = 0; i < count; i++)
+            job(i);
+        return;
+    }
+
+    m_Job.store(&job, std::memory_order_release);
+    m_Remaining.store(count, std::memory_order_release);
+
+    // Hand out contiguous ranges so every thread starts on neighbouring items
+    auto queueCount = (uint32_t)m_Queues.size();
+    for (uint32_t q = 0; q < queueCount; q++)
+    {
+        uint32_t begin = (uint32_t)((uint64_t)count * q / queueCount);
+        uint32_t end = (uint32_t)((uint64_t)count * (q + 1) / queueCount);
+
+        std::lock_guard<std::mutex> lock(m_Queues[q]->mutex);
+        for (uint32_t i = begin; i < end; i++)
+            m_Queues[q]->items.push_back(i);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Generation++;
+    }
+    m_WakeCondition.notify_all();
+
+    while (RunOne(0)) {}
+
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_DoneCondition.wait(lock, [this]() { return m_Remaining.load(std::memory_order_acquire) == 0; });
+    m_Job.store(nullptr, std::memory_order_release);
+}
+
+void ThreadPool::WorkerLoop(uint32_t threadIndex)
+{
+    s_ThreadIndex = threadIndex;
+    uint64_t generation = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_WakeCondition.wait(lock, [&]() { return m_Stopping || m_Generation != generation; });
+            if (m_Stopping)
+                return;
+            generation = m_Generation;
+        }
+
+        while (RunOne(threadIndex)) {}
+    }
+}
+
+bool ThreadPool::RunOne(uint32_t threadIndex)
+{
+    uint32_t index = 0;
+    bool found = false;
+
+    // Own queue first, front to back
+    {
+        WorkQueue& queue = *m_Queues[threadIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.items.empty())
+        {
+            index = queue.items.front();
+            queue.items.pop_front();
+            found = true;
+        }
+    }
+
+    // Steal from the back of the others
+    auto queueCount = (uint32_t)m_Queues.size();
+    for (uint32_t i = 1; !found && i < queueCount; i++)
+    {
+        WorkQueue& queue = *m_Queues[(threadIndex + i) % queueCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.items.empty())
+        {
+            index = queue.items.back();
+            queue.items.pop_back();
+            found = true;
+        }
+    }
+
+    if (!found)
+        return false;
+
+    const Job* job = m_Job.load(std::memory_order_acquire);
+    (*job)(index);
+
+    if (m_Remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_DoneCondition.notify_all();
+    }
+    return true;
+}
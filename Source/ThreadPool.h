@@ -0,0 +1,62 @@
+#ifndef RTX_THREADPOOL_H
+#define RTX_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads for data-parallel loops.
+// Every worker owns a queue of job indices; it pops from the front of its own queue
+// and steals from the back of the other queues once it runs dry.
+class ThreadPool
+{
+public:
+    using Job = std::function<void(uint32_t index)>;
+public:
+    // 0 threads means one per hardware thread
+    explicit ThreadPool(uint32_t threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Resize(uint32_t threadCount);
+    // Includes the calling thread, which takes part in every ParallelFor
+    uint32_t GetThreadCount() const { return (uint32_t)m_Queues.size(); }
+
+    // Runs job(0) ... job(count - 1) and blocks until all of them have finished
+    void ParallelFor(uint32_t count, const Job& job);
+
+    // Index of the current thread inside the pool, 0 for the calling thread
+    static uint32_t GetThreadIndex();
+private:
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<uint32_t> items;
+    };
+
+    void Start(uint32_t threadCount);
+    void Stop();
+    void WorkerLoop(uint32_t threadIndex);
+    bool RunOne(uint32_t threadIndex);
+private:
+    std::vector<std::thread> m_Threads;
+    std::vector<std::unique_ptr<WorkQueue>> m_Queues;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_WakeCondition;
+    std::condition_variable m_DoneCondition;
+
+    std::atomic<const Job*> m_Job{ nullptr };
+    std::atomic<uint32_t> m_Remaining{ 0 };
+    uint64_t m_Generation = 0;
+    bool m_Stopping = false;
+};
+
+#endif //RTX_THREADPOOL_H
@@ -0,0 +1,48 @@
+#ifndef RTX_TRIPLEBUFFER_H
+#define RTX_TRIPLEBUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of the latest value from one producer thread to one consumer thread.
+// The producer fills its buffer and publishes it by swapping it with the middle one; the consumer
+// swaps the middle buffer with its own when a newer one is there. Neither side ever waits and the
+// consumer always sees the most recently published value, older ones are overwritten.
+template<typename T>
+class TripleBuffer
+{
+public:
+    // Producer side
+    T& GetWriteBuffer() { return m_Buffers[m_WriteIndex]; }
+
+    // Returns false if the previously published value was never acquired, it is the next write buffer then
+    bool Publish()
+    {
+        uint32_t previous = m_Middle.exchange(m_WriteIndex | FreshBit, std::memory_order_acq_rel);
+        m_WriteIndex = previous & IndexMask;
+        return !(previous & FreshBit);
+    }
+
+    // Consumer side, returns true if something was published since the last call
+    bool Acquire()
+    {
+        if (!(m_Middle.load(std::memory_order_relaxed) & FreshBit))
+            return false;
+
+        uint32_t previous = m_Middle.exchange(m_ReadIndex, std::memory_order_acq_rel);
+        m_ReadIndex = previous & IndexMask;
+        return true;
+    }
+
+    const T& GetReadBuffer() const { return m_Buffers[m_ReadIndex]; }
+private:
+    static constexpr uint32_t IndexMask = 3;
+    static constexpr uint32_t FreshBit = 4;
+
+    T m_Buffers[3];
+    uint32_t m_WriteIndex = 0;
+    uint32_t m_ReadIndex = 1;
+    std::atomic<uint32_t> m_Middle{ 2 };
+};
+
+#endif //RTX_TRIPLEBUFFER_H
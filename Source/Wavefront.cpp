@@ -0,0 +1,63 @@
+#include "Wavefront.h"
+
+void RayQueue::Reserve(uint32_t capacity)
+{
+    if (m_Path.size() >= capacity)
+        return;
+
+    m_OriginX.resize(capacity);
+    m_OriginY.resize(capacity);
+    m_OriginZ.resize(capacity);
+    m_DirectionX.resize(capacity);
+    m_DirectionY.resize(capacity);
+    m_DirectionZ.resize(capacity);
+    m_Path.resize(capacity);
+}
+
+void RayQueue::Push(uint32_t path, const Ray& ray)
+{
+    uint32_t index = m_Count++;
+    m_OriginX[index] = ray.origin.x;
+    m_OriginY[index] = ray.origin.y;
+    m_OriginZ[index] = ray.origin.z;
+    m_DirectionX[index] = ray.direction.x;
+    m_DirectionY[index] = ray.direction.y;
+    m_DirectionZ[index] = ray.direction.z;
+    m_Path[index] = path;
+}
+
+void WavefrontBatch::Clear()
+{
+    x.clear();
+    y.clear();
+    sampleIndex.clear();
+}
+
+void WavefrontBatch::Push(uint32_t pixelX, uint32_t pixelY, uint32_t pixelSampleIndex)
+{
+    x.push_back(pixelX);
+    y.push_back(pixelY);
+    sampleIndex.push_back(pixelSampleIndex);
+}
+
+void WavefrontBatch::Prepare()
+{
+    // Every path has at most one ray and one shadow ray per bounce in flight
+    uint32_t count = GetPathCount();
+    throughputR.resize(count);
+    throughputG.resize(count);
+    throughputB.resize(count);
+    radiance.resize(count);
+
+    rays.Reserve(count);
+    nextRays.Reserve(count);
+    shadowRays.Reserve(count);
+    if (hitDistance.size() < count)
+    {
+        hitDistance.resize(count);
+        hitSphere.resize(count);
+        shadowR.resize(count);
+        shadowG.resize(count);
+        shadowB.resize(count);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef RTX_WAVEFRONT_H
+#define RTX_WAVEFRONT_H
+
+#include "Scene.h"
+#include "AlignedAllocator.h"
+#include <vector>
+
+// Rays of a wavefront batch as structure-of-arrays, each with the index of the path it belongs to.
+// Stages only push the rays of paths that are still alive, so every queue stays dense.
+class RayQueue
+{
+public:
+    // Keeps the memory, so a batch of the same size allocates nothing
+    void Clear() { m_Count = 0; }
+    void Reserve(uint32_t capacity);
+    void Push(uint32_t path, const Ray& ray);
+
+    Ray GetRay(uint32_t index) const
+    {
+        return {{m_OriginX[index], m_OriginY[index], m_OriginZ[index]}, {m_DirectionX[index], m_DirectionY[index], m_DirectionZ[index]}};
+    }
+    uint32_t GetPath(uint32_t index) const { return m_Path[index]; }
+    uint32_t GetCount() const { return m_Count; }
+private:
+    using FloatArray = std::vector<float, AlignedAllocator<float, 32>>;
+
+    FloatArray m_OriginX, m_OriginY, m_OriginZ;
+    FloatArray m_DirectionX, m_DirectionY, m_DirectionZ;
+    std::vector<uint32_t> m_Path;
+    uint32_t m_Count = 0;
+};
+
+// Everything the wavefront engine keeps between its stages, reused from one batch to the next.
+// The caller fills the per-path inputs, Renderer::TraceWavefront writes radiance.
+struct WavefrontBatch {
+    using FloatArray = std::vector<float, AlignedAllocator<float, 32>>;
+
+    // Bounces with their own traversal timer, deeper ones are added to the last
+    static constexpr uint32_t TimedBounces = 8;
+
+    // Per path, the pixel and its sample index
+    std::vector<uint32_t> x, y, sampleIndex;
+    FloatArray throughputR, throughputG, throughputB;
+    std::vector<glm::vec3> radiance;
+
+    // Per ray of the current bounce and the rays of the next one
+    RayQueue rays, nextRays;
+    FloatArray hitDistance;
+    std::vector<uint32_t> hitSphere;
+
+    // Toward the sun, with what they add to their path if nothing blocks them
+    RayQueue shadowRays;
+    FloatArray shadowR, shadowG, shadowB;
+
+    // Sort key in the upper half, ray index in the lower
+    std::vector<uint64_t> sortKeys;
+
+    // Of the last TraceWavefront, in ns
+    uint64_t traversalTime[TimedBounces] = {};
+    uint64_t sortTime = 0;
+
+    void Clear();
+    void Push(uint32_t pixelX, uint32_t pixelY, uint32_t pixelSampleIndex);
+    uint32_t GetPathCount() const { return (uint32_t)x.size(); }
+    // Sizes the per-ray and per-path buffers for the paths pushed so far
+    void Prepare();
+};
+
+#endif //RTX_WAVEFRONT_H
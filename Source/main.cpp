@@ -1,23 +1,210 @@
 #include <io.h>
 #include <Renderer.h>
+#include <RenderThread.h>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+struct HeadlessOptions {
+    uint32_t width = 1280;
+    uint32_t height = 720;
+    uint32_t samples = 64;
+    uint32_t threads = 0;
+    std::string output = "render.png";
+};
+
+static bool EndsWith(const std::string& string, const std::string& suffix)
+{
+    return string.size() >= suffix.size() && string.compare(string.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Writes the average of the accumulated samples, .hdr keeps the float data, everything else the displayed 8 bit image
+static bool WriteImage(const Renderer& renderer, const std::string& path)
+{
+    int width = (int)renderer.GetWidth();
+    int height = (int)renderer.GetHeight();
+    const glm::vec4* accumulation = renderer.GetAccumulationData();
+
+    // Row 0 of the framebuffer is the bottom of the image
+    stbi_flip_vertically_on_write(1);
+
+    if (EndsWith(path, ".hdr"))
+    {
+        std::vector<glm::vec4> pixels(width * height);
+        for (size_t i = 0; i < pixels.size(); i++)
+            pixels[i] = accumulation[i] / accumulation[i].a;
+        return stbi_write_hdr(path.c_str(), width, height, 4, glm::value_ptr(pixels[0]));
+    }
+
+    const uint32_t* pixels = renderer.GetImageData();
+    if (EndsWith(path, ".bmp"))
+        return stbi_write_bmp(path.c_str(), width, height, 4, pixels);
+    if (EndsWith(path, ".tga"))
+        return stbi_write_tga(path.c_str(), width, height, 4, pixels);
+    if (EndsWith(path, ".jpg") || EndsWith(path, ".jpeg"))
+        return stbi_write_jpg(path.c_str(), width, height, 4, pixels, 95);
+    return stbi_write_png(path.c_str(), width, height, 4, pixels, width * 4);
+}
+
+// Renders without GLFW, Vulkan or ImGui and writes the result to disk
+static int RunHeadless(const HeadlessOptions& options)
+{
+    Renderer renderer;
+    renderer.GetSettings().threadCount = options.threads;
+    // Every pixel gets exactly the requested samples
+    renderer.GetSettings().adaptive = false;
+    renderer.GetSettings().progressivePreview = false;
+    renderer.Resize(options.width, options.height);
+
+    uint64_t rayCount = 0;
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < options.samples; i++)
+    {
+        renderer.Render();
+        rayCount += renderer.GetStatistics().rayCount;
+    }
+    double totalTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+    std::cout << "Rendered " << options.width << "x" << options.height << " with " << options.samples << " samples in "
+              << totalTime * 1000.0 << "ms (" << totalTime * 1000.0 / std::max(options.samples, 1u) << "ms/sample)\n";
+    std::cout << rayCount << " rays, " << (double)rayCount / totalTime / 1e6 << " Mrays/s\n";
+
+    if (!WriteImage(renderer, options.output))
+    {
+        std::cerr << "[ERROR] Failed to write " << options.output << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Saved " << options.output << "\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    bool headless = false;
+    HeadlessOptions options;
+    bool valid = true;
+    try
+    {
+        for (int i = 1; i < argc && valid; i++)
+        {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--headless")
+                headless = true;
+            else if (arg == "--width" && hasValue)
+                options.width = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--height" && hasValue)
+                options.height = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--samples" && hasValue)
+                options.samples = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--threads" && hasValue)
+                options.threads = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--output" && hasValue)
+                options.output = argv[++i];
+            else
+                valid = false;
+        }
+    }
+    catch (const std::invalid_argument&)
+    {
+        valid = false;
+    }
+    catch (const std::out_of_range&)
+    {
+        valid = false;
+    }
+
+    // Without a single sample the framebuffer is never written and the average divides by zero
+    if (!valid || options.width == 0 || options.height == 0 || options.samples == 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--headless] [--width W] [--height H] [--samples N] [--threads T] [--output file.png|.bmp|.tga|.jpg|.hdr]\n"
+                  << "       W, H and N are at least 1\n";
+        return EXIT_FAILURE;
+    }
+
+    if (headless)
+        return RunHeadless(options);
 
-int main() {
     chdir("../..");
     SauronLT::Init(1280, 720, "rtx");
     SauronLT::SetBackground({0.6f, 0.55f, 0.75f, 1.0f});
 
-    Renderer renderer;
-    double lastRenderTime = 0.0f;
+    // Traces on its own thread, the loop below only handles UI and uploads finished frames
+    RenderThread renderer;
+    double lastFrameTime = 0.0f;
 
     while (SauronLT::Running()) {
         SauronLT::BeginFrame();
         double beginTime = glfwGetTime();
 
+        // The render thread restarts accumulation once it sees the new camera position
+        renderer.GetCamera().Update((float)lastFrameTime);
+
+        const RenderThread::Frame& frame = renderer.GetFrame();
+
         ImGui::Begin("Settings");
-        ImGui::Text("Last render: %.3fms", (float)lastRenderTime * 1000.0f);
+        ImGui::Text("Last frame: %.3fms", (float)lastFrameTime * 1000.0f);
+        ImGui::Text("Last render: %.3fms, %u samples", frame.statistics.renderTime, frame.sampleCount);
+        int presentMode = (int)SauronLT::GetPresentMode();
+        if (ImGui::Combo("Present mode", &presentMode, "FIFO\0Mailbox\0Immediate\0"))
+            SauronLT::SetPresentMode((SauronLT::PresentMode)presentMode);
+        uint32_t imageCount = SauronLT::GetSwapchainImageCount();
+        if (ImGui::DragScalar("Swapchain images", ImGuiDataType_U32, &imageCount, 0.05f))
+            SauronLT::SetSwapchainImageCount(imageCount);
+        float frameLimit = SauronLT::GetFrameLimit();
+        if (ImGui::DragFloat("Frame limit", &frameLimit, 1.0f, 0.0f, 1000.0f, frameLimit > 0.0f ? "%.0f fps" : "Off"))
+            SauronLT::SetFrameLimit(frameLimit);
+        ImGui::Text("Input latency: %.2fms (%s)", SauronLT::GetInputLatency(), SauronLT::GetPresentModeName(SauronLT::GetActivePresentMode()));
         ImGui::Checkbox("Accumulate", &renderer.GetSettings().accumulate);
+        ImGui::DragScalar("Threads", ImGuiDataType_U32, &renderer.GetSettings().threadCount, 0.1f);
+        ImGui::DragScalar("Tile size", ImGuiDataType_U32, &renderer.GetSettings().tileSize, 0.1f);
+        ImGui::Checkbox("Lazy rays", &renderer.GetSettings().lazyRays);
+        ImGui::Checkbox("Jitter", &renderer.GetSettings().jitter);
+        ImGui::Checkbox("Wavefront", &renderer.GetSettings().wavefront);
+        if (renderer.GetSettings().wavefront)
+        {
+            ImGui::Checkbox("Sort rays", &renderer.GetSettings().sortRays);
+            ImGui::Text("Ray sorting: %.3fms", frame.statistics.sortTime);
+            for (uint32_t bounce = 0; bounce < WavefrontBatch::TimedBounces; bounce++)
+            {
+                if (frame.statistics.traversalTime[bounce] > 0.0f)
+                    ImGui::Text("Bounce %u traversal: %.3fms", bounce, frame.statistics.traversalTime[bounce]);
+            }
+        }
+        int sampler = (int)renderer.GetSettings().sampler;
+        if (ImGui::Combo("Sampler", &sampler, "Independent\0Stratified\0Sobol\0Blue noise\0"))
+        {
+            renderer.GetSettings().sampler = (Sampler::Type)sampler;
+            renderer.ResetFrameIndex();
+        }
+        if (ImGui::Checkbox("Legacy shading", &renderer.GetSettings().legacyShading))
+            renderer.ResetFrameIndex();
+        if (ImGui::Checkbox("Importance sampling", &renderer.GetSettings().importanceSampling))
+            renderer.ResetFrameIndex();
+        if (ImGui::DragScalar("Max bounces", ImGuiDataType_U32, &renderer.GetSettings().maxBounces, 0.1f))
+            renderer.ResetFrameIndex();
+        ImGui::Checkbox("Russian roulette", &renderer.GetSettings().russianRoulette);
+        ImGui::Text("Path length: %.2f rays avg", frame.statistics.averagePathLength);
+        ImGui::Checkbox("Adaptive", &renderer.GetSettings().adaptive);
+        ImGui::DragFloat("Threshold", &renderer.GetSettings().adaptiveThreshold, 0.0001f, 0.0001f, 0.1f, "%.4f");
+        ImGui::DragScalar("Max samples/frame", ImGuiDataType_U32, &renderer.GetSettings().adaptiveMaxSamples, 0.1f);
+        ImGui::Checkbox("Show sample count", &renderer.GetSettings().showSampleCount);
+        ImGui::Text("Active pixels: %.1f%%, %u samples each", frame.statistics.activeFraction * 100.0f, frame.statistics.samplesPerPixel);
+        ImGui::Checkbox("Reprojection", &renderer.GetSettings().reprojection);
+        ImGui::DragScalar("Max history samples", ImGuiDataType_U32, &renderer.GetSettings().reprojectionMaxSamples, 0.5f);
+        ImGui::Text("Reprojected pixels: %.1f%%", frame.statistics.reprojectedFraction * 100.0f);
+        ImGui::Checkbox("Progressive preview", &renderer.GetSettings().progressivePreview);
+        ImGui::DragFloat("Preview budget", &renderer.GetSettings().previewFrameBudget, 0.1f, 1.0f, 100.0f, "%.1fms");
+        ImGui::Text("Preview blocks: %ux%u", 1u << frame.statistics.previewLevel, 1u << frame.statistics.previewLevel);
         if (ImGui::Button("Reset"))
             renderer.ResetFrameIndex();
+
+        const BVH::Statistics& bvhStats = frame.bvhStatistics;
+        ImGui::Text("BVH build: %.3fms", bvhStats.buildTime);
+        ImGui::Text("BVH nodes: %u, leaves: %u, depth: %u", bvhStats.nodeCount, bvhStats.leafCount, bvhStats.maxDepth);
+        ImGui::Text("BVH leaf size: %.2f avg, %u max", bvhStats.averageLeafSize, bvhStats.maxLeafSize);
         ImGui::End();
 
         ImGui::Begin("Scene");
@@ -27,9 +214,12 @@ int main() {
                 ImGui::PushID(i);
 
                 Sphere &sphere = scene.spheres[i];
-                ImGui::DragFloat3("Position", glm::value_ptr(sphere.position), 0.01f);
-                ImGui::DragFloat("Radius", &sphere.radius, 0.01f);
-                ImGui::DragInt("Material", &sphere.materialIndex, 1.0f, 0, (int) scene.materials.size() - 1);
+                if (ImGui::DragFloat3("Position", glm::value_ptr(sphere.position), 0.01f))
+                    renderer.InvalidateScene();
+                if (ImGui::DragFloat("Radius", &sphere.radius, 0.01f))
+                    renderer.InvalidateScene();
+                if (ImGui::DragInt("Material", &sphere.materialIndex, 1.0f, 0, (int) scene.materials.size() - 1))
+                    renderer.InvalidateScene();
 
                 ImGui::Separator();
 
@@ -41,9 +231,12 @@ int main() {
                 ImGui::PushID(i);
 
                 Material &material = scene.materials[i];
-                ImGui::ColorEdit3("Albedo", glm::value_ptr(material.albedo));
-                ImGui::DragFloat("Roughness", &material.roughness, 0.005f, 0.0f, 1.0f);
-                ImGui::DragFloat("Metallic", &material.metallic, 0.005f, 0.0f, 1.0f);
+                if (ImGui::ColorEdit3("Albedo", glm::value_ptr(material.albedo)))
+                    renderer.InvalidateMaterials();
+                if (ImGui::DragFloat("Roughness", &material.roughness, 0.005f, 0.0f, 1.0f))
+                    renderer.InvalidateMaterials();
+                if (ImGui::DragFloat("Metallic", &material.metallic, 0.005f, 0.0f, 1.0f))
+                    renderer.InvalidateMaterials();
 
                 ImGui::Separator();
 
@@ -59,17 +252,22 @@ int main() {
         float viewportHeight = ImGui::GetContentRegionAvail().y;
 
         renderer.Resize((uint32_t)viewportWidth, (uint32_t)viewportHeight);
-        renderer.Render();
+        renderer.Submit(SauronLT::GetInputTime());
+        renderer.Present();
+        // The viewport shows what the render thread made of an earlier frame's input
+        SauronLT::SetFrameInputTime(renderer.GetFrame().inputTime);
 
         auto image = renderer.GetImage();
-        if (image)
-            ImGui::Image(image->GetDescriptorSet(), {(float) image->GetWidth(), (float) image->GetHeight()}, ImVec2(0, 1), ImVec2(1, 0));
+        if (image) {
+            glm::vec2 uv = renderer.GetImageUV();
+            ImGui::Image(image->GetDescriptorSet(), {viewportWidth, viewportHeight}, ImVec2(0, uv.y), ImVec2(uv.x, 0));
+        }
 
         ImGui::End();
         ImGui::PopStyleVar();
 
         SauronLT::EndFrame();
-        lastRenderTime = glfwGetTime() - beginTime;
+        lastFrameTime = glfwGetTime() - beginTime;
     }
 
     renderer.Destroy();